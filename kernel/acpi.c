@@ -0,0 +1,121 @@
+// SUB OS - ACPI Table Lookup
+// Copyright (c) 2025 SUB OS Project
+//
+// Only what drivers need to find their hardware: the RSDP is searched for
+// in the EBDA and the BIOS ROM area, and tables are looked up by signature
+// in the RSDT. Tables in RAM the direct map covers are used in place,
+// others are mapped with ioremap and stay mapped.
+
+#include "acpi.h"
+#include "paging.h"
+#include "vmalloc.h"
+#include "kernel.h"
+
+#define RSDP_SIGNATURE   "RSD PTR "
+#define BDA_EBDA_SEGMENT 0x40E
+
+typedef struct {
+    char signature[8];
+    unsigned char checksum;
+    char oem_id[6];
+    unsigned char revision;
+    unsigned int rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+static acpi_header_t* rsdt = 0;
+
+static int bytes_equal(const char* a, const char* b, unsigned int len) {
+    for (unsigned int i = 0; i < len; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+static int checksum_ok(const void* data, unsigned int len) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    unsigned char sum = 0;
+    for (unsigned int i = 0; i < len; i++) sum += bytes[i];
+    return sum == 0;
+}
+
+static acpi_rsdp_t* rsdp_scan(unsigned int start, unsigned int end) {
+    for (unsigned int addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)addr;
+        if (bytes_equal(rsdp->signature, RSDP_SIGNATURE, 8) &&
+            checksum_ok(rsdp, sizeof(acpi_rsdp_t))) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+// Kernel pointer to size bytes of firmware memory at physical
+static void* acpi_map(unsigned int physical, unsigned int size) {
+    int direct = 1;
+    for (unsigned int page = physical & PAGE_FRAME; page < physical + size; page += PAGE_SIZE) {
+        if (virt_to_phys(page) != page) {
+            direct = 0;
+            break;
+        }
+    }
+    if (direct) return (void*)physical;
+    return ioremap(physical, size);
+}
+
+// Map a whole table: its header first, to learn the length
+static acpi_header_t* acpi_map_table(unsigned int physical) {
+    acpi_header_t* header = (acpi_header_t*)acpi_map(physical, sizeof(acpi_header_t));
+    if (!header) return 0;
+    unsigned int length = header->length;
+    if ((unsigned int)header != physical) {
+        iounmap(header);
+        header = (acpi_header_t*)acpi_map(physical, length);
+        if (!header) return 0;
+    }
+    return checksum_ok(header, length) ? header : 0;
+}
+
+int acpi_init() {
+    // The EBDA segment is stored in the BIOS data area, in page 0, which
+    // is left unmapped to catch null pointers
+    unsigned int ebda = 0;
+    volatile unsigned short* bda = (volatile unsigned short*)ioremap(BDA_EBDA_SEGMENT, 2);
+    if (bda) {
+        ebda = (unsigned int)*bda << 4;
+        iounmap((void*)bda);
+    }
+    acpi_rsdp_t* rsdp = 0;
+    if (ebda) rsdp = rsdp_scan(ebda, ebda + 1024);
+    if (!rsdp) rsdp = rsdp_scan(0xE0000, 0x100000);
+    if (!rsdp) {
+        print_string("[ACPI] No RSDP found\n");
+        return 0;
+    }
+
+    rsdt = acpi_map_table(rsdp->rsdt_address);
+    if (!rsdt || !bytes_equal(rsdt->signature, "RSDT", 4)) {
+        rsdt = 0;
+        print_string("[ACPI] Bad RSDT\n");
+        return 0;
+    }
+    print_string("[OK] ACPI: RSDT at ");
+    print_hex(rsdp->rsdt_address);
+    print_string(", ");
+    print_dec((rsdt->length - sizeof(acpi_header_t)) / 4);
+    print_string(" tables\n");
+    return 1;
+}
+
+acpi_header_t* acpi_find_table(const char* signature) {
+    if (!rsdt) return 0;
+    unsigned int count = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    unsigned int* entries = (unsigned int*)(rsdt + 1);
+    for (unsigned int i = 0; i < count; i++) {
+        acpi_header_t* header = (acpi_header_t*)acpi_map(entries[i], sizeof(acpi_header_t));
+        if (!header) continue;
+        int match = bytes_equal(header->signature, signature, 4);
+        if ((unsigned int)header != entries[i]) iounmap(header);
+        if (match) return acpi_map_table(entries[i]);
+    }
+    return 0;
+}
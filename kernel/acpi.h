@@ -0,0 +1,67 @@
+// SUB OS - ACPI Table Lookup Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef ACPI_H
+#define ACPI_H
+
+// Common header of every system description table
+typedef struct {
+    char signature[4];
+    unsigned int length;        // of the whole table, header included
+    unsigned char revision;
+    unsigned char checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    unsigned int oem_revision;
+    unsigned int creator_id;
+    unsigned int creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+// Generic address structure (register location)
+typedef struct {
+    unsigned char space_id;     // 0 = memory, 1 = I/O port
+    unsigned char bit_width;
+    unsigned char bit_offset;
+    unsigned char access_size;
+    unsigned long long address;
+} __attribute__((packed)) acpi_address_t;
+
+// HPET description table
+typedef struct {
+    acpi_header_t header;
+    unsigned int block_id;
+    acpi_address_t base;
+    unsigned char number;
+    unsigned short min_tick;
+    unsigned char page_protection;
+} __attribute__((packed)) acpi_hpet_t;
+
+// Multiple APIC description table, followed by variable-length entries
+typedef struct {
+    acpi_header_t header;
+    unsigned int lapic_address;
+    unsigned int flags;
+} __attribute__((packed)) acpi_madt_t;
+
+#define MADT_LOCAL_APIC     0
+#define MADT_LAPIC_ENABLED  0x1
+
+typedef struct {
+    unsigned char type;
+    unsigned char length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    unsigned char processor_id;
+    unsigned char apic_id;
+    unsigned int flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+// Find the RSDP and root table. Returns 0 if the firmware has no ACPI.
+int acpi_init();
+
+// Mapped table with the given signature (e.g. "HPET"), or 0
+acpi_header_t* acpi_find_table(const char* signature);
+
+#endif
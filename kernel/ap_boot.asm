@@ -0,0 +1,74 @@
+[bits 16]
+; Application Processor Startup
+; SUB OS - Real-mode trampoline for the other CPUs
+;
+; smp.c copies everything from ap_trampoline to ap_trampoline_end to
+; AP_TRAMPOLINE (a page below 1MB) and sends each CPU a STARTUP IPI
+; pointing there. The CPU starts in real mode with CS = that page, so
+; the code below only uses offsets relative to ap_trampoline. smp.c
+; fills in the parameter block before every start.
+
+global ap_trampoline
+global ap_trampoline_end
+global ap_param_cr3
+global ap_param_cr4
+global ap_param_stack
+global ap_param_entry
+
+AP_TRAMPOLINE equ 0x70000
+
+%define REL(x) ((x) - ap_trampoline)
+%define ABS(x) (AP_TRAMPOLINE + (x) - ap_trampoline)
+
+section .text
+
+ap_trampoline:
+    cli
+    cld
+    mov ax, cs
+    mov ds, ax
+    lgdt [REL(ap_gdt_pointer)]
+
+    mov eax, cr0
+    or eax, 1              ; PE
+    mov cr0, eax
+    jmp dword 0x08:ABS(ap_protected)
+
+[bits 32]
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Same paging setup as the boot CPU: CR4 (PSE/PGE/PAE) before CR3
+    mov eax, [ABS(ap_param_cr4)]
+    mov cr4, eax
+    mov eax, [ABS(ap_param_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80000000     ; PG
+    mov cr0, eax
+
+    mov esp, [ABS(ap_param_stack)]
+    mov eax, [ABS(ap_param_entry)]
+    jmp eax
+
+; Flat code and data, enough to reach the kernel's own GDT
+align 8
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF  ; 0x08: code
+    dq 0x00CF92000000FFFF  ; 0x10: data
+ap_gdt_pointer:
+    dw ap_gdt_pointer - ap_gdt - 1
+    dd ABS(ap_gdt)
+
+ap_param_cr3:   dd 0
+ap_param_cr4:   dd 0
+ap_param_stack: dd 0
+ap_param_entry: dd 0
+
+ap_trampoline_end:
@@ -0,0 +1,118 @@
+// SUB OS - Local APIC
+// Copyright (c) 2025 SUB OS Project
+//
+// Just enough of the local APIC for SMP: IPIs to start the other CPUs,
+// EOI, and a periodic timer so CPUs without the PIT still get ticks.
+// Legacy PIC interrupts keep reaching the boot CPU through LINT0
+// (virtual wire mode).
+
+#include "apic.h"
+#include "vmalloc.h"
+#include "paging.h"
+#include "clock.h"
+#include "timer.h"
+#include "kernel.h"
+
+// Register offsets, in 32-bit words
+#define LAPIC_ID            (0x020 / 4)
+#define LAPIC_EOI           (0x0B0 / 4)
+#define LAPIC_SVR           (0x0F0 / 4)
+#define LAPIC_ICR_LOW       (0x300 / 4)
+#define LAPIC_ICR_HIGH      (0x310 / 4)
+#define LAPIC_LVT_TIMER     (0x320 / 4)
+#define LAPIC_LVT_LINT0     (0x350 / 4)
+#define LAPIC_LVT_LINT1     (0x360 / 4)
+#define LAPIC_TIMER_INIT    (0x380 / 4)
+#define LAPIC_TIMER_CURRENT (0x390 / 4)
+#define LAPIC_TIMER_DIVIDE  (0x3E0 / 4)
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_LVT_MASKED    0x10000
+#define LAPIC_LVT_PERIODIC  0x20000
+#define LAPIC_LVT_EXTINT    0x700
+#define LAPIC_LVT_NMI       0x400
+#define LAPIC_ICR_INIT      0x4500      // INIT, level assert
+#define LAPIC_ICR_STARTUP   0x4600      // STARTUP, level assert
+#define LAPIC_ICR_FIXED     0x4000      // fixed, level assert
+#define LAPIC_ICR_OTHERS    0xC0000     // shorthand: all excluding self
+#define LAPIC_ICR_PENDING   0x1000
+#define LAPIC_DIVIDE_16     0x3
+
+static volatile unsigned int* lapic = 0;
+static unsigned int timer_count = 0;    // LAPIC timer counts per tick
+
+static int cpu_has_apic() {
+    unsigned int eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx >> 9) & 1;
+}
+
+int apic_init(phys_addr_t base) {
+    if (!cpu_has_apic()) return 0;
+    lapic = (volatile unsigned int*)ioremap(base, PAGE_SIZE);
+    if (!lapic) return 0;
+    apic_enable_cpu(1);
+
+    // Count timer decrements over one tick's worth of calibrated TSC
+    if (clock_get_tsc_khz()) {
+        lapic[LAPIC_TIMER_DIVIDE] = LAPIC_DIVIDE_16;
+        lapic[LAPIC_LVT_TIMER] = LAPIC_LVT_MASKED | APIC_TIMER_VECTOR;
+        lapic[LAPIC_TIMER_INIT] = 0xFFFFFFFF;
+        udelay(1000000 / TIMER_FREQUENCY);
+        timer_count = 0xFFFFFFFF - lapic[LAPIC_TIMER_CURRENT];
+        lapic[LAPIC_TIMER_INIT] = 0;
+    }
+    return 1;
+}
+
+void apic_enable_cpu(int boot_cpu) {
+    lapic[LAPIC_SVR] = LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR;
+    lapic[LAPIC_LVT_TIMER] = LAPIC_LVT_MASKED | APIC_TIMER_VECTOR;
+    if (boot_cpu) {
+        // Pass the 8259 through, as the BIOS left it
+        lapic[LAPIC_LVT_LINT0] = LAPIC_LVT_EXTINT;
+        lapic[LAPIC_LVT_LINT1] = LAPIC_LVT_NMI;
+    } else {
+        lapic[LAPIC_LVT_LINT0] = LAPIC_LVT_MASKED;
+        lapic[LAPIC_LVT_LINT1] = LAPIC_LVT_MASKED;
+    }
+}
+
+unsigned int apic_id() {
+    return lapic[LAPIC_ID] >> 24;
+}
+
+void apic_eoi() {
+    lapic[LAPIC_EOI] = 0;
+}
+
+static void apic_send_ipi(unsigned int apic_id, unsigned int command) {
+    lapic[LAPIC_ICR_HIGH] = apic_id << 24;
+    lapic[LAPIC_ICR_LOW] = command;
+    while (lapic[LAPIC_ICR_LOW] & LAPIC_ICR_PENDING) {
+        asm volatile("pause");
+    }
+}
+
+void apic_send_init(unsigned int apic_id) {
+    apic_send_ipi(apic_id, LAPIC_ICR_INIT);
+}
+
+void apic_send_startup(unsigned int apic_id, unsigned int vector) {
+    apic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (vector & 0xFF));
+}
+
+void apic_send_ipi_to(unsigned int apic_id, unsigned int vector) {
+    apic_send_ipi(apic_id, LAPIC_ICR_FIXED | (vector & 0xFF));
+}
+
+void apic_send_ipi_others(unsigned int vector) {
+    apic_send_ipi(0, LAPIC_ICR_OTHERS | LAPIC_ICR_FIXED | (vector & 0xFF));
+}
+
+void apic_timer_start() {
+    if (!timer_count) return;
+    lapic[LAPIC_TIMER_DIVIDE] = LAPIC_DIVIDE_16;
+    lapic[LAPIC_LVT_TIMER] = LAPIC_LVT_PERIODIC | APIC_TIMER_VECTOR;
+    lapic[LAPIC_TIMER_INIT] = timer_count;
+}
@@ -0,0 +1,38 @@
+// SUB OS - Local APIC Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef APIC_H
+#define APIC_H
+
+#include "pmm.h"
+
+// Vectors above the remapped PIC range
+#define APIC_TIMER_VECTOR     0x40
+#define APIC_TLB_VECTOR       0x41    // TLB shootdown (smp.c)
+#define APIC_WAKE_VECTOR      0x42    // no work, just ends a hlt
+#define APIC_SPURIOUS_VECTOR  0xFF
+
+// Map the local APIC registers (same physical address on every CPU),
+// enable the boot CPU's and time its timer against the TSC.
+// Returns 0 if there is no usable APIC.
+int apic_init(phys_addr_t base);
+
+// Software-enable the calling CPU's local APIC. Only the boot CPU takes
+// legacy PIC interrupts.
+void apic_enable_cpu(int boot_cpu);
+
+unsigned int apic_id();
+void apic_eoi();
+
+// INIT / STARTUP inter-processor interrupts for bringing up a CPU
+void apic_send_init(unsigned int apic_id);
+void apic_send_startup(unsigned int apic_id, unsigned int vector);
+
+// Fixed interrupt on one CPU, or on every other CPU
+void apic_send_ipi_to(unsigned int apic_id, unsigned int vector);
+void apic_send_ipi_others(unsigned int vector);
+
+// Periodic timer at TIMER_FREQUENCY on the calling CPU
+void apic_timer_start();
+
+#endif
@@ -9,20 +9,17 @@
 #include "kernel.h"
 #include "keyboard.h"
 #include "timer.h"
+#include "clock.h"
 #include "pmm.h"
+#include "heap.h"
+#include "memtag.h"
+#include "process.h"
 
 // ── Helpers ─────────────────────────────────────────────────────────────────
 
+// Debounce: give the key time to come back up before polling again.
 static void wait_key_released(void) {
-    volatile int i;
-    for (i = 0; i < 100000; i++) asm volatile("nop");
-}
-
-// Blocking read: spin+hlt until a char arrives in the keyboard buffer.
-static char kb_wait(void) {
-    char c;
-    do { c = keyboard_getchar(); asm volatile("hlt"); } while (!c);
-    return c;
+    udelay(50000);
 }
 
 // Non-blocking scancode peek directly from the PS/2 port.
@@ -143,7 +140,7 @@ void app_notepad(void) {
             buf[cur_row][cur_col] ? buf[cur_row][cur_col] : ' ',
             VGA_COLOR(VGA_BLACK, VGA_LIGHT_GREEN));
 
-        char c = kb_wait();
+        char c = keyboard_wait();
 
         // Restore cell under cursor
         gui_draw_char(NP_OFF_C + cur_col, NP_OFF_R + cur_row,
@@ -258,7 +255,7 @@ void app_calculator(void) {
         " W/A/S/D=Nav  Enter=Press  ESC=Exit ", bc);
 
     while (1) {
-        char c = kb_wait();
+        char c = keyboard_wait();
         if (c == 27) break;
 
         // Navigation
@@ -394,7 +391,7 @@ void app_filemanager(void) {
         " W/S=Navigate  Enter=Open  ESC=Exit ", bc);
 
     while (1) {
-        char c = kb_wait();
+        char c = keyboard_wait();
         if (c == 27) break;
         if ((c == 'w' || c == 'W') && sel > 0)               sel--;
         if ((c == 's' || c == 'S') && sel < fm_file_count-1)  sel++;
@@ -409,7 +406,7 @@ void app_filemanager(void) {
                 VGA_COLOR(VGA_LIGHT_RED, VGA_BLACK));
             gui_draw_string(22, 14, "Press any key to close",
                 VGA_COLOR(VGA_LIGHT_GREY, VGA_BLACK));
-            kb_wait();
+            keyboard_wait();
             FM_RENDER();
             continue;
         }
@@ -448,11 +445,11 @@ void app_sysmon(void) {
     while (1) {
         if (do_refresh) {
             unsigned long uptime   = get_uptime();
-            unsigned int total_mem = pmm_get_total_memory() / 1024;
-            unsigned int used_mem  = pmm_get_used_memory()  / 1024;
-            unsigned int free_mem  = pmm_get_free_memory()  / 1024;
-            int mem_pct = total_mem ?
-                (int)((used_mem * 100) / total_mem) : 0;
+            unsigned int total_mem = pmm_get_total_kb();
+            unsigned int used_mem  = pmm_get_used_kb();
+            unsigned int free_mem  = pmm_get_free_kb();
+            int mem_pct = total_mem >= 100 ?
+                (int)(used_mem / (total_mem / 100)) : 0;
 
             int base = SM_R + 2;
 
@@ -485,6 +482,26 @@ void app_sysmon(void) {
                                     mem_pct > 50 ? bar_warn : bar_fill;
             draw_bar(SM_C+2, base+1, SM_W-6, mem_pct, mem_bar, bar_empty);
 
+            // Pages per subsystem, then heap fragmentation
+            int tx = SM_C+2;
+            for (unsigned int tag = 0; tag < MEM_TAG_COUNT; tag++) {
+                unsigned int pages;
+                pmm_get_tag_stats(tag, &pages, 0);
+                if (!pages) continue;
+                char pn[12];
+                int_to_str((int)pages, pn);
+                const char* name = memtag_name(tag);
+                if (tx + str_len(name) + str_len(pn) + 2 > SM_C + SM_W - 18) break;
+                gui_draw_string(tx, base+2, name, lbl); tx += str_len(name);
+                gui_draw_string(tx, base+2, ":", lbl); tx += 1;
+                gui_draw_string(tx, base+2, pn, val_c); tx += str_len(pn) + 1;
+            }
+            char fr[8];
+            int_to_str((int)heap_get_fragmentation(), fr);
+            gui_draw_string(SM_C+SM_W-16, base+2, "Heap frag", lbl);
+            gui_draw_string(SM_C+SM_W-6, base+2, fr, val_c);
+            gui_draw_string(SM_C+SM_W-6+str_len(fr), base+2, "%", val_c);
+
             // ── Uptime ──────────────────────────────────────────────────────
             base += 3;
             gui_fill_rect(SM_C+1, base, SM_W-2, 1, ' ', bg);
@@ -538,6 +555,6 @@ void app_sysmon(void) {
         // Auto-refresh every ~300 timer ticks
         if (timer_get_ticks() % 300 == 0) do_refresh = 1;
 
-        asm volatile("hlt");
+        process_idle();
     }
 }
@@ -2,21 +2,40 @@
 // Copyright (c) 2025 SUB OS Project
 
 #include "ata.h"
+#include "clock.h"
+#include "wait.h"
 #include "kernel.h"
 
 static ata_device_t ata_devices[4];
 static int ata_device_count = 0;
 
+// Per channel: callers sleep on irq_wait until the drive interrupts, and
+// lock keeps a second transfer from issuing commands mid-way through one
+static wait_queue_t ata_irq_wait[2];
+static mutex_t ata_locks[2];
+
+static int ata_channel(unsigned short io_base) {
+    return io_base == ATA_PRIMARY_IO ? 0 : 1;
+}
+
+// IRQ14/15: reading status acknowledges the drive
+void ata_irq_handler(int channel) {
+    inb((channel == 0 ? ATA_PRIMARY_IO : ATA_SECONDARY_IO) + ATA_REG_STATUS);
+    wake_up_all(&ata_irq_wait[channel]);
+}
+
+// The waits sleep until the drive interrupts, re-polling every tick in
+// case the interrupt went missing (or was for the other drive)
 static void ata_wait_bsy(unsigned short io_base) {
-    while (inb(io_base + ATA_REG_STATUS) & ATA_SR_BSY);
+    wait_queue_t* queue = &ata_irq_wait[ata_channel(io_base)];
+    while (!wait_event_timeout(queue, !(inb(io_base + ATA_REG_STATUS) & ATA_SR_BSY), 1));
 }
 static void ata_wait_drq(unsigned short io_base) {
-    while (!(inb(io_base + ATA_REG_STATUS) & ATA_SR_DRQ));
+    wait_queue_t* queue = &ata_irq_wait[ata_channel(io_base)];
+    while (!wait_event_timeout(queue, inb(io_base + ATA_REG_STATUS) & (ATA_SR_DRQ | ATA_SR_ERR), 1));
 }
 static void ata_delay_400ns(unsigned short io_base) {
-    for (int i = 0; i < 4; i++) {
-        inb(io_base + ATA_REG_STATUS);
-    }
+    ndelay(400);
 }
 static void ata_soft_reset(unsigned short control_base) {
     outb(control_base, 0x04);
@@ -62,6 +81,10 @@ int ata_identify(unsigned char drive, ata_device_t* device) {
 }
 void ata_init() {
     print_string("[OK] Initializing ATA Driver...\n");
+    for (int i = 0; i < 2; i++) {
+        wait_queue_init(&ata_irq_wait[i]);
+        mutex_init(&ata_locks[i]);
+    }
     ata_device_count = 0;
     for (unsigned char i = 0; i < 4; i++) {
         if (ata_identify(i, &ata_devices[ata_device_count]) == 0) {
@@ -87,6 +110,8 @@ int ata_read_sectors(unsigned char drive, unsigned int lba, unsigned char count,
     ata_device_t* dev = &ata_devices[drive];
     unsigned short io_base = dev->io_base;
     unsigned char drive_sel = (dev->drive % 2 == 0) ? 0xE0 : 0xF0;
+    mutex_t* lock = &ata_locks[ata_channel(io_base)];
+    mutex_lock(lock);
     ata_wait_bsy(io_base);
     outb(io_base + ATA_REG_DRIVE, drive_sel | ((lba >> 24) & 0x0F));
     ata_delay_400ns(io_base);
@@ -100,6 +125,7 @@ int ata_read_sectors(unsigned char drive, unsigned int lba, unsigned char count,
         ata_wait_drq(io_base);
         unsigned char status = inb(io_base + ATA_REG_STATUS);
         if (status & ATA_SR_ERR) {
+            mutex_unlock(lock);
             print_string("[ATA] Read error\n");
             return -1;
         }
@@ -107,6 +133,7 @@ int ata_read_sectors(unsigned char drive, unsigned int lba, unsigned char count,
             buf[sector * 256 + i] = inw(io_base + ATA_REG_DATA);
         }
     }
+    mutex_unlock(lock);
     return 0;
 }
 int ata_write_sectors(unsigned char drive, unsigned int lba, unsigned char count, const void* buffer) {
@@ -114,6 +141,8 @@ int ata_write_sectors(unsigned char drive, unsigned int lba, unsigned char count
     ata_device_t* dev = &ata_devices[drive];
     unsigned short io_base = dev->io_base;
     unsigned char drive_sel = (dev->drive % 2 == 0) ? 0xE0 : 0xF0;
+    mutex_t* lock = &ata_locks[ata_channel(io_base)];
+    mutex_lock(lock);
     ata_wait_bsy(io_base);
     outb(io_base + ATA_REG_DRIVE, drive_sel | ((lba >> 24) & 0x0F));
     ata_delay_400ns(io_base);
@@ -131,6 +160,7 @@ int ata_write_sectors(unsigned char drive, unsigned int lba, unsigned char count
         outb(io_base + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
         ata_wait_bsy(io_base);
     }
+    mutex_unlock(lock);
     return 0;
 }
 ata_device_t* ata_get_device(unsigned char drive) {
@@ -53,6 +53,7 @@ typedef struct {
 } ata_device_t;
 
 void ata_init();
+void ata_irq_handler(int channel);
 int ata_read_sectors(unsigned char drive, unsigned int lba, unsigned char count, void* buffer);
 int ata_write_sectors(unsigned char drive, unsigned int lba, unsigned char count, const void* buffer);
 int ata_identify(unsigned char drive, ata_device_t* device);
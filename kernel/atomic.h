@@ -0,0 +1,75 @@
+// SUB OS - Atomic Operations
+// Copyright (c) 2025 SUB OS Project
+//
+// Integer atomics and memory barriers. On x86 every read-modify-write
+// here is one lock-prefixed instruction, so these are inline rather than
+// calls; plain loads and stores of an aligned int are already atomic.
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+typedef struct {
+    volatile int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(value) { (value) }
+
+// Compiler-only barrier
+#define barrier()  asm volatile("" ::: "memory")
+// Full barrier; x86 only reorders stores after later loads
+#define smp_mb()   __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()  barrier()
+#define smp_wmb()  barrier()
+
+// Spin-wait hint: saves power and the memory-order flush on loop exit
+static inline void cpu_relax() {
+    asm volatile("pause" ::: "memory");
+}
+
+static inline int atomic_read(const atomic_t* v) {
+    return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_set(atomic_t* v, int value) {
+    __atomic_store_n(&v->counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_add(atomic_t* v, int value) {
+    __atomic_add_fetch(&v->counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_sub(atomic_t* v, int value) {
+    __atomic_sub_fetch(&v->counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_inc(atomic_t* v) {
+    atomic_add(v, 1);
+}
+
+static inline void atomic_dec(atomic_t* v) {
+    atomic_sub(v, 1);
+}
+
+// Returns the new value; fully ordered
+static inline int atomic_add_return(atomic_t* v, int value) {
+    return __atomic_add_fetch(&v->counter, value, __ATOMIC_SEQ_CST);
+}
+
+// Nonzero if the decrement brought the counter to zero
+static inline int atomic_dec_and_test(atomic_t* v) {
+    return atomic_add_return(v, -1) == 0;
+}
+
+// Returns the old value; the store happened if it equals old
+static inline int atomic_cmpxchg(atomic_t* v, int old, int value) {
+    __atomic_compare_exchange_n(&v->counter, &old, value, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return old;
+}
+
+// Returns the old value
+static inline int atomic_xchg(atomic_t* v, int value) {
+    return __atomic_exchange_n(&v->counter, value, __ATOMIC_SEQ_CST);
+}
+
+#endif
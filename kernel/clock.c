@@ -0,0 +1,170 @@
+// SUB OS - Clock Source
+// Copyright (c) 2025 SUB OS Project
+//
+// The TSC is timed against a reference of known frequency at boot: the
+// HPET main counter when ACPI describes one, otherwise PIT channel 2
+// (gated through port 0x61, so the tick on channel 0 is not disturbed).
+// Cycles are turned into nanoseconds with a multiply and shift, since the
+// kernel has no 64-bit division at run time.
+
+#include "clock.h"
+#include "acpi.h"
+#include "vmalloc.h"
+#include "timer.h"
+#include "kernel.h"
+
+#define CALIBRATE_MS    50          // PIT counter max is ~54.9ms
+#define PIT_FREQUENCY   1193182
+#define PIT_CHANNEL_2   0x42
+#define PIT_COMMAND     0x43
+#define PIT_GATE_PORT   0x61
+
+// HPET registers (32-bit halves of the 64-bit ones)
+#define HPET_PERIOD     1           // upper half of capabilities: fs per tick
+#define HPET_CONFIG     4
+#define HPET_COUNTER    60          // main counter, low half
+#define HPET_ENABLE     0x1
+#define HPET_MAX_PERIOD 100000000   // 100ns, the spec's upper bound
+
+static unsigned int tsc_khz = 0;
+static unsigned long long tsc_base = 0;
+static unsigned int ns_mult = 0;    // ns = cycles * ns_mult >> ns_shift
+static unsigned int ns_shift = 0;
+static const char* clock_source = "ticks";
+
+static unsigned long long rdtsc() {
+    unsigned int low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((unsigned long long)high << 32) | low;
+}
+
+static int cpu_has_tsc() {
+    unsigned int eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx >> 4) & 1;
+}
+
+// 64 by 32 bit division done as two divl steps; the quotient's high
+// half comes from dividing the dividend's high half on its own
+static unsigned long long div64_32(unsigned long long n, unsigned int base) {
+    unsigned int high = (unsigned int)(n >> 32);
+    unsigned int rem = high % base;
+    unsigned int low;
+    asm("divl %4" : "=a"(low), "=d"(rem) : "a"((unsigned int)n), "d"(rem), "rm"(base));
+    return ((unsigned long long)(high / base) << 32) | low;
+}
+
+// TSC cycles per ms, timed over a one-shot count of PIT channel 2
+static unsigned int calibrate_pit() {
+    unsigned int count = PIT_FREQUENCY * CALIBRATE_MS / 1000;
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);  // gate on, speaker off
+    outb(PIT_COMMAND, 0xB0);  // Channel 2, lobyte/hibyte, interrupt on terminal count
+    outb(PIT_CHANNEL_2, count & 0xFF);
+    outb(PIT_CHANNEL_2, (count >> 8) & 0xFF);
+
+    unsigned long long start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20));  // OUT2 rises at terminal count
+    unsigned long long end = rdtsc();
+    return (unsigned int)div64_32(end - start, CALIBRATE_MS);
+}
+
+// TSC cycles per ms, timed against the HPET main counter, or 0
+static unsigned int calibrate_hpet() {
+    acpi_hpet_t* table = (acpi_hpet_t*)acpi_find_table("HPET");
+    if (!table || table->base.space_id != 0) return 0;
+    volatile unsigned int* hpet = (volatile unsigned int*)ioremap(table->base.address, 1024);
+    if (!hpet) return 0;
+
+    unsigned int period_fs = hpet[HPET_PERIOD];
+    if (period_fs == 0 || period_fs > HPET_MAX_PERIOD) {
+        iounmap((void*)hpet);
+        return 0;
+    }
+    hpet[HPET_CONFIG] |= HPET_ENABLE;
+
+    unsigned int ticks = (unsigned int)div64_32(CALIBRATE_MS * 1000000000000ULL, period_fs);
+    unsigned int start = hpet[HPET_COUNTER];
+    unsigned long long tsc_start = rdtsc();
+    while (hpet[HPET_COUNTER] - start < ticks);
+    unsigned long long tsc_end = rdtsc();
+    iounmap((void*)hpet);
+    return (unsigned int)div64_32(tsc_end - tsc_start, CALIBRATE_MS);
+}
+
+void clock_init() {
+    if (!cpu_has_tsc()) {
+        print_string("[CLOCK] No TSC, falling back to timer ticks\n");
+        return;
+    }
+
+    unsigned int khz = calibrate_hpet();
+    clock_source = "HPET";
+    if (!khz) {
+        khz = calibrate_pit();
+        clock_source = "PIT";
+    }
+    if (!khz) {
+        clock_source = "ticks";
+        print_string("[CLOCK] TSC calibration failed\n");
+        return;
+    }
+
+    // Largest shift that keeps the multiplier within 32 bits
+    ns_shift = 32;
+    while (ns_shift && div64_32(1000000ULL << ns_shift, khz) > 0xFFFFFFFFULL) ns_shift--;
+    ns_mult = (unsigned int)div64_32(1000000ULL << ns_shift, khz);
+    tsc_base = rdtsc();
+    tsc_khz = khz;
+
+    print_string("[OK] Clock: TSC ");
+    print_dec(khz / 1000);
+    print_string(" MHz, calibrated against ");
+    print_string(clock_source);
+    print_string("\n");
+}
+
+unsigned long long clock_cycles() {
+    return rdtsc();
+}
+
+unsigned long long clock_ns() {
+    if (!tsc_khz) {
+        return (unsigned long long)timer_get_ticks() * (1000000000 / TIMER_FREQUENCY);
+    }
+    unsigned long long cycles = rdtsc() - tsc_base;
+    unsigned long long low = (unsigned long long)(unsigned int)cycles * ns_mult;
+    unsigned long long high = (unsigned long long)(unsigned int)(cycles >> 32) * ns_mult;
+    return (low >> ns_shift) + (high << (32 - ns_shift));
+}
+
+static void delay_cycles(unsigned long long cycles) {
+    unsigned long long start = rdtsc();
+    while (rdtsc() - start < cycles) {
+        asm volatile("pause");
+    }
+}
+
+// Before calibration, a read of the unused port 0x80 takes about 1us
+void udelay(unsigned int us) {
+    if (!tsc_khz) {
+        while (us--) inb(0x80);
+        return;
+    }
+    delay_cycles(div64_32((unsigned long long)us * tsc_khz, 1000));
+}
+
+void ndelay(unsigned int ns) {
+    if (!tsc_khz) {
+        udelay((ns + 999) / 1000);
+        return;
+    }
+    delay_cycles(div64_32((unsigned long long)ns * tsc_khz + 999999, 1000000));
+}
+
+unsigned int clock_get_tsc_khz() {
+    return tsc_khz;
+}
+
+const char* clock_get_source() {
+    return clock_source;
+}
@@ -0,0 +1,24 @@
+// SUB OS - Clock Source Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+// Calibrate the TSC against the HPET, or the PIT if there is none
+void clock_init();
+
+// Monotonic nanoseconds since clock_init
+unsigned long long clock_ns();
+
+// Raw TSC cycles
+unsigned long long clock_cycles();
+
+// Calibrated busy waits, for short device delays
+void udelay(unsigned int us);
+void ndelay(unsigned int ns);
+
+// TSC rate and what it was calibrated against
+unsigned int clock_get_tsc_khz();
+const char* clock_get_source();
+
+#endif
@@ -0,0 +1,65 @@
+// SUB OS - Work-Stealing Deque
+// Copyright (c) 2025 SUB OS Project
+//
+// The fixed-size variant of the Chase-Lev deque (as formulated for weak
+// memory models by Le et al.). The owner and thieves only contend for the
+// last item, which is settled with a compare-and-swap on top. Indices are
+// free-running and compared by signed difference, so wraparound is fine.
+
+#include "deque.h"
+
+void deque_init(deque_t* deque) {
+    deque->top = 0;
+    deque->bottom = 0;
+    for (int i = 0; i < DEQUE_SIZE; i++) deque->slots[i] = 0;
+}
+
+int deque_push(deque_t* deque, void* item) {
+    unsigned int bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    unsigned int top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if ((int)(bottom - top) >= DEQUE_SIZE) return 0;
+    deque->slots[bottom & (DEQUE_SIZE - 1)] = item;
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void* deque_pop(deque_t* deque) {
+    unsigned int bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned int top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if ((int)(bottom - top) < 0) {
+        // Empty
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    void* item = deque->slots[bottom & (DEQUE_SIZE - 1)];
+    if (bottom == top) {
+        // Last item: race the thieves for it
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            item = 0;
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return item;
+}
+
+void* deque_steal(deque_t* deque) {
+    unsigned int top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned int bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if ((int)(bottom - top) <= 0) return 0;
+
+    void* item = deque->slots[top & (DEQUE_SIZE - 1)];
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return item;
+}
+
+int deque_empty(deque_t* deque) {
+    return (int)(deque->bottom - deque->top) <= 0;
+}
@@ -0,0 +1,29 @@
+// SUB OS - Work-Stealing Deque Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#define DEQUE_SIZE 64   // power of two
+
+// Chase-Lev deque: the owning CPU pushes and pops at the bottom, any
+// other CPU may steal from the top. No locks; indices only ever grow.
+typedef struct {
+    volatile unsigned int top;
+    volatile unsigned int bottom;
+    void* volatile slots[DEQUE_SIZE];
+} deque_t;
+
+void deque_init(deque_t* deque);
+
+// Owner only. deque_push returns 0 when the deque is full.
+int deque_push(deque_t* deque, void* item);
+void* deque_pop(deque_t* deque);
+
+// Any CPU. Returns 0 when empty or when another CPU won the race.
+void* deque_steal(deque_t* deque);
+
+// Racy hint, for deciding whether stealing is worth a try
+int deque_empty(deque_t* deque);
+
+#endif
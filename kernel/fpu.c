@@ -0,0 +1,196 @@
+// SUB OS - FPU/SSE Context
+// Copyright (c) 2025 SUB OS Project
+//
+// FPU state is switched lazily. A switch only sets CR0.TS; the first
+// FPU or SSE instruction after it raises #NM, and only then is the
+// process's state loaded. Processes that never use the FPU never trap
+// and never have anything saved.
+//
+// Each CPU remembers whose state its registers hold (fpu_owner). State
+// is saved when its owner is switched out having used the FPU, so a
+// process may be picked up by another CPU without its registers being
+// stranded here. The registers stay valid after that save: if the same
+// process comes back before anyone else loads theirs, TS is left clear
+// and it does not trap at all.
+
+#include "fpu.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "kernel.h"
+
+#define CR0_MP          0x02        // WAIT/FWAIT honour TS
+#define CR0_EM          0x04        // no FPU: emulate (must be clear)
+#define CR0_TS          0x08        // task switched: next FPU use traps
+#define CR0_NE          0x20        // x87 errors raise #MF, not IRQ13
+#define CR4_OSFXSR      0x200       // FXSAVE/FXRSTOR and SSE enabled
+#define CR4_OSXMMEXCPT  0x400       // SSE errors raise #XM
+
+#define CPUID_FXSR      (1 << 24)
+#define CPUID_SSE       (1 << 25)
+
+#define MXCSR_DEFAULT   0x1F80      // all SSE exceptions masked
+
+static int fpu_has_fxsr = 0;
+static unsigned int fpu_cr4 = 0;
+static fpu_state_t fpu_initial;     // after FNINIT, for first use
+
+static atomic_t fpu_loads = ATOMIC_INIT(0);
+static atomic_t fpu_saves = ATOMIC_INIT(0);
+
+static unsigned int read_cr0(void) {
+    unsigned int cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static void write_cr0(unsigned int cr0) {
+    asm volatile("mov %0, %%cr0" :: "r"(cr0) : "memory");
+}
+
+static void fpu_enable(void) {
+    asm volatile("clts" ::: "memory");
+}
+
+static void fpu_disable(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_save(fpu_state_t* state) {
+    if (fpu_has_fxsr) {
+        asm volatile("fxsave %0" : "=m"(*state));
+    } else {
+        // FNSAVE reinitializes the FPU, so the registers stop holding it
+        asm volatile("fnsave %0; fwait" : "=m"(*state));
+        this_cpu()->fpu_owner = 0;
+    }
+    atomic_inc(&fpu_saves);
+}
+
+// Word copy; a plain struct assignment may become a memcpy call
+static void fpu_copy(fpu_state_t* dst, const fpu_state_t* src) {
+    unsigned int* d = (unsigned int*)dst->data;
+    const unsigned int* s = (const unsigned int*)src->data;
+    for (unsigned int i = 0; i < sizeof(fpu_state_t) / 4; i++) d[i] = s[i];
+}
+
+static void fpu_restore(const fpu_state_t* state) {
+    if (fpu_has_fxsr) {
+        asm volatile("fxrstor %0" :: "m"(*state));
+    } else {
+        asm volatile("frstor %0" :: "m"(*state));
+    }
+}
+
+void fpu_init() {
+    print_string("[OK] Initializing FPU...\n");
+    unsigned int eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    fpu_has_fxsr = (edx & CPUID_FXSR) != 0;
+    if (fpu_has_fxsr && (edx & CPUID_SSE)) {
+        fpu_cr4 = CR4_OSFXSR | CR4_OSXMMEXCPT;
+    }
+
+    // CR4 set here is handed on to the other CPUs by smp_init
+    fpu_init_cpu();
+    fpu_enable();
+    asm volatile("fninit");
+    if (fpu_cr4) {
+        unsigned int mxcsr = MXCSR_DEFAULT;
+        asm volatile("ldmxcsr %0" :: "m"(mxcsr));
+    }
+    fpu_save(&fpu_initial);
+    fpu_disable();
+    atomic_set(&fpu_saves, 0);
+
+    print_string(fpu_cr4 ? "  FXSAVE, SSE enabled\n" :
+                 fpu_has_fxsr ? "  FXSAVE, no SSE\n" : "  FNSAVE only\n");
+    print_string("[OK] FPU initialized (lazy switching)\n");
+}
+
+void fpu_init_cpu() {
+    if (fpu_cr4) {
+        unsigned int cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" :: "r"(cr4 | fpu_cr4));
+    }
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+    cpu_t* cpu = this_cpu();
+    cpu->fpu_owner = 0;
+    cpu->fpu_live = 0;
+}
+
+void fpu_process_init(process_t* process) {
+    process->fpu_used = 0;
+    process->fpu_cpu = FPU_NO_CPU;
+}
+
+void fpu_switch(process_t* prev, process_t* next) {
+    cpu_t* cpu = this_cpu();
+
+    // TS is clear only if prev used the FPU (or kept it from last time)
+    if (cpu->fpu_live && prev->state != PROCESS_TERMINATED) fpu_save(&prev->fpu);
+
+    // Registers still hold next's state if nobody loaded theirs since
+    int live = cpu->fpu_owner == next && next->fpu_cpu == cpu->index;
+    if (live != cpu->fpu_live) {
+        if (live) fpu_enable();
+        else fpu_disable();
+        cpu->fpu_live = live;
+    }
+}
+
+// Runs with interrupts off (interrupt gate), so no switch can intervene
+void fpu_trap() {
+    cpu_t* cpu = this_cpu();
+    process_t* current = cpu->current;
+    if (!current) return;
+    fpu_enable();
+    cpu->fpu_live = 1;
+    if (cpu->fpu_owner == current && current->fpu_cpu == cpu->index) return;
+
+    if (!current->fpu_used) {
+        fpu_copy(&current->fpu, &fpu_initial);
+        current->fpu_used = 1;
+    }
+    fpu_restore(&current->fpu);
+    cpu->fpu_owner = current;
+    current->fpu_cpu = cpu->index;
+    atomic_inc(&fpu_loads);
+}
+
+void fpu_fork(process_t* child, process_t* parent) {
+    fpu_process_init(child);
+    if (!parent->fpu_used) return;
+    unsigned int flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    if (cpu->fpu_live && cpu->fpu_owner == parent) fpu_save(&parent->fpu);
+    irq_restore(flags);
+    fpu_copy(&child->fpu, &parent->fpu);
+    child->fpu_used = 1;
+}
+
+unsigned int kernel_fpu_begin() {
+    unsigned int flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    if (cpu->fpu_live) fpu_save(&cpu->current->fpu);
+    fpu_enable();
+    // Whatever the kernel leaves in the registers belongs to nobody
+    cpu->fpu_owner = 0;
+    cpu->fpu_live = 1;
+    return flags;
+}
+
+void kernel_fpu_end(unsigned int flags) {
+    cpu_t* cpu = this_cpu();
+    fpu_disable();
+    cpu->fpu_live = 0;
+    irq_restore(flags);
+}
+
+unsigned long fpu_get_loads() {
+    return (unsigned long)atomic_read(&fpu_loads);
+}
+
+unsigned long fpu_get_saves() {
+    return (unsigned long)atomic_read(&fpu_saves);
+}
@@ -0,0 +1,44 @@
+// SUB OS - FPU/SSE Context Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef FPU_H
+#define FPU_H
+
+#define FPU_NO_CPU  0xFFFFFFFF      // fpu_cpu of state held by no CPU
+
+// x87/MMX/SSE register image, FXSAVE layout (FNSAVE uses the first 108
+// bytes on CPUs without FXSR)
+typedef struct {
+    unsigned char data[512];
+} __attribute__((aligned(16))) fpu_state_t;
+
+struct process;
+
+// Boot CPU: detect FXSR/SSE and build the state new processes start with
+void fpu_init();
+
+// Every CPU: enable the FPU with CR0.TS set, so first use traps
+void fpu_init_cpu();
+
+// Fresh process: no FPU state until it first uses the FPU
+void fpu_process_init(struct process* process);
+
+// Context switch hook (interrupts off)
+void fpu_switch(struct process* prev, struct process* next);
+
+// #NM handler: give the FPU to the current process
+void fpu_trap();
+
+// Copy the parent's FPU state to a forked child
+void fpu_fork(struct process* child, struct process* parent);
+
+// Bracket FPU/SSE use by kernel code running on behalf of a process.
+// Interrupts stay off in between; the process's state is saved first.
+unsigned int kernel_fpu_begin();
+void kernel_fpu_end(unsigned int flags);
+
+// Statistics
+unsigned long fpu_get_loads();
+unsigned long fpu_get_saves();
+
+#endif
@@ -0,0 +1,90 @@
+// SUB OS - Futexes
+// Copyright (c) 2025 SUB OS Project
+//
+// A futex is a user-space word the kernel can sleep on. A lock built on
+// one only enters the kernel when it is contended:
+//
+//   0 free, 1 locked, 2 locked with (possible) sleepers
+//
+//   lock:    if cmpxchg(w, 0, 1) != 0:
+//                while xchg(w, 2) != 0: futex(w, FUTEX_WAIT, 2)
+//   unlock:  if xchg(w, 0) == 2: futex(w, FUTEX_WAKE, 1)
+//
+// FUTEX_WAIT re-checks the word after queuing the caller, so an unlock
+// between the user-space test and the sleep is not lost.
+//
+// Sleepers are keyed by the physical address of the word, so processes
+// sharing the frame meet on the same key, hashed onto a fixed set of
+// wait queues.
+
+#include "futex.h"
+#include "wait.h"
+#include "process.h"
+#include "paging.h"
+#include "vma.h"
+#include "kernel.h"
+
+#define FUTEX_BUCKETS 64
+
+static wait_queue_t futex_queues[FUTEX_BUCKETS];
+
+void futex_init() {
+    print_string("[OK] Initializing Futexes...\n");
+    for (int i = 0; i < FUTEX_BUCKETS; i++) {
+        wait_queue_init(&futex_queues[i]);
+    }
+}
+
+// Check uaddr and find its key. Returns 0 if it is not a usable word.
+// The word has to be in a writable area of the caller; it is written
+// here (adding 0) so that a pending demand fill or copy-on-write break
+// happens now, not between a wait and the matching wake, which would
+// change the key.
+static int futex_key(unsigned int* uaddr, unsigned long long* key) {
+    process_t* current = process_get_current();
+    unsigned int address = (unsigned int)uaddr;
+    if (!current || (address & 3) ||
+        address < USER_SPACE_START || address >= USER_SPACE_END) {
+        return 0;
+    }
+    vm_area_t* vma = vma_find(current->vm_areas, address);
+    if (!vma || (vma->flags & (VMA_WRITE | VMA_USER)) != (VMA_WRITE | VMA_USER)) {
+        return 0;
+    }
+    __atomic_fetch_add(uaddr, 0, __ATOMIC_SEQ_CST);
+    phys_addr_t phys;
+    if (!paging_user_phys(address, &phys)) return 0;
+    *key = phys;
+    return 1;
+}
+
+// Hash the frame number and word offset in 32 bits (no 64-bit division)
+static wait_queue_t* futex_queue(unsigned long long key) {
+    unsigned int frame = (unsigned int)(key >> 12);
+    unsigned int word = ((unsigned int)key & 0xFFF) >> 2;
+    return &futex_queues[(word ^ frame) % FUTEX_BUCKETS];
+}
+
+int futex_wait(unsigned int* uaddr, unsigned int val) {
+    unsigned long long key;
+    if (!futex_key(uaddr, &key)) return -1;
+    wait_queue_t* queue = futex_queue(key);
+
+    wait_entry_t entry;
+    wait_entry_init(&entry);
+    entry.key = key;
+    wait_prepare(queue, &entry);
+    if (__atomic_load_n(uaddr, __ATOMIC_SEQ_CST) != val) {
+        wait_finish(queue, &entry);
+        return 1;
+    }
+    wait_schedule(&entry);
+    wait_finish(queue, &entry);
+    return 0;
+}
+
+int futex_wake(unsigned int* uaddr, int count) {
+    unsigned long long key;
+    if (!futex_key(uaddr, &key)) return -1;
+    return wake_up_key(futex_queue(key), key, count);
+}
@@ -0,0 +1,19 @@
+// SUB OS - Futexes
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#define FUTEX_WAIT  0
+#define FUTEX_WAKE  1
+
+void futex_init();
+
+// Sleep if *uaddr still holds val. Returns 0 after a wakeup, 1 if the
+// value had already changed, -1 if uaddr is not a usable futex word.
+int futex_wait(unsigned int* uaddr, unsigned int val);
+
+// Wake up to count sleepers on uaddr. Returns the number woken, or -1.
+int futex_wake(unsigned int* uaddr, int count);
+
+#endif
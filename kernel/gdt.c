@@ -0,0 +1,59 @@
+// SUB OS - Global Descriptor Table
+// Copyright (c) 2025 SUB OS Project
+//
+// The boot sector's GDT only has flat kernel code and data. The kernel
+// replaces it with one GDT per CPU that adds the user segments, that
+// CPU's TSS and a small data segment based at its per-CPU area, which
+// kernel code reaches through GS.
+
+#include "gdt.h"
+
+extern void tss_flush();
+
+typedef struct {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed)) gdt_pointer_t;
+
+// access: present/DPL/type byte. flags: granularity and size nibble.
+static unsigned long long gdt_entry(unsigned int base, unsigned int limit,
+                                    unsigned char access, unsigned char flags) {
+    unsigned long long entry = 0;
+    entry |= limit & 0xFFFF;
+    entry |= (unsigned long long)(base & 0xFFFFFF) << 16;
+    entry |= (unsigned long long)access << 40;
+    entry |= (unsigned long long)((limit >> 16) & 0xF) << 48;
+    entry |= (unsigned long long)(flags & 0xF) << 52;
+    entry |= (unsigned long long)((base >> 24) & 0xFF) << 56;
+    return entry;
+}
+
+void gdt_init_cpu(unsigned long long* gdt, unsigned int tss_base, unsigned int tss_limit,
+                  unsigned int percpu_base, unsigned int percpu_limit) {
+    gdt[0] = 0;
+    gdt[GDT_KERNEL_CODE / 8] = gdt_entry(0, 0xFFFFF, 0x9A, 0xC);
+    gdt[GDT_KERNEL_DATA / 8] = gdt_entry(0, 0xFFFFF, 0x92, 0xC);
+    gdt[GDT_USER_CODE / 8]   = gdt_entry(0, 0xFFFFF, 0xFA, 0xC);
+    gdt[GDT_USER_DATA / 8]   = gdt_entry(0, 0xFFFFF, 0xF2, 0xC);
+    gdt[GDT_TSS / 8]         = gdt_entry(tss_base, tss_limit, 0x89, 0x0);
+    gdt[GDT_PERCPU / 8]      = gdt_entry(percpu_base, percpu_limit, 0x92, 0x4);
+
+    gdt_pointer_t pointer;
+    pointer.limit = GDT_ENTRIES * 8 - 1;
+    pointer.base = (unsigned int)gdt;
+    asm volatile("lgdt %0" :: "m"(pointer));
+
+    // Reload CS with a far return, then the data segments
+    asm volatile("pushl %0\n"
+                 "pushl $1f\n"
+                 "lret\n"
+                 "1:\n"
+                 "mov %1, %%ds\n"
+                 "mov %1, %%es\n"
+                 "mov %1, %%fs\n"
+                 "mov %1, %%ss\n"
+                 "mov %2, %%gs\n"
+                 :: "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA), "r"(GDT_PERCPU)
+                 : "memory");
+    tss_flush();
+}
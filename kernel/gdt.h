@@ -0,0 +1,22 @@
+// SUB OS - Global Descriptor Table Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef GDT_H
+#define GDT_H
+
+// Selectors. Every CPU has its own GDT with the same layout; only the TSS
+// and per-CPU data descriptors point at different memory.
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x18
+#define GDT_USER_DATA   0x20
+#define GDT_TSS         0x28
+#define GDT_PERCPU      0x30    // loaded into GS in the kernel
+#define GDT_ENTRIES     7
+
+// Build and load a CPU's GDT, reload the segment registers, point GS at
+// the per-CPU area and load the task register
+void gdt_init_cpu(unsigned long long* gdt, unsigned int tss_base, unsigned int tss_limit,
+                  unsigned int percpu_base, unsigned int percpu_limit);
+
+#endif
@@ -191,9 +191,7 @@ void gui_draw_desktop(void) {
     desktop_draw(sel);
 
     while (1) {
-        char c = keyboard_getchar();
-        asm volatile("hlt");
-        if (!c) continue;
+        char c = keyboard_wait();
 
         if (c == 27) break;  // ESC -> back to shell
 
@@ -1,124 +1,514 @@
 // SUB OS - Heap Allocator
 // Copyright (c) 2025 SUB OS Project
+//
+// Segregated-fit allocator with boundary tags. Every block carries its
+// size and a used bit in both a header and a footer, so kfree can find
+// and merge both neighbours in constant time. Free blocks sit on one of
+// HEAP_NUM_CLASSES lists: exact 8-byte classes for small blocks, then one
+// class per power of two. A bitmap of non-empty classes lets kmalloc pick
+// a list with a single bit scan.
+//
+// The heap lives in its own kernel virtual range (KHEAP_START). It starts
+// at KHEAP_INITIAL_SIZE, grows by mapping fresh frames when no free block
+// fits, and unmaps whole pages again when a large free block ends up at
+// the tail.
+//
+// Allocations carry a MEM_TAG_* owner for per-subsystem accounting. A used
+// block's footer is never read for its size (only free neighbours are
+// merged backwards), so it holds the owner instead.
+//
+// One lock covers the free lists, tags and counters. It is taken with
+// interrupts off and dropped before a moving krealloc copies.
 
 #include "heap.h"
+#include "memtag.h"
 #include "pmm.h"
+#include "paging.h"
+#include "spinlock.h"
 #include "kernel.h"
 
-// Heap block header
+#define HEAP_ALIGN          8
+#define HEAP_TAG_SIZE       4
+#define HEAP_MIN_BLOCK      16     // header + two links + footer
+#define HEAP_USED           1
+#define HEAP_OWNER_SHIFT    3      // owner tag in a used block's footer
+#define HEAP_NUM_CLASSES    32
+#define HEAP_EXACT_CLASSES  15     // block sizes 16..128 in 8-byte steps
+#define HEAP_EXACT_MAX      128
+#define HEAP_PAGE_SIZE      4096
+// Only shrink when at least this many whole pages are idle at the tail
+#define HEAP_SHRINK_PAGES   4
+
+// Free block layout; used blocks only keep the header and footer
 typedef struct heap_block {
-    unsigned int size;
-    unsigned int is_free;
+    unsigned int header;
     struct heap_block* next;
+    struct heap_block* prev;
 } heap_block_t;
 
-// Heap start and end
-static heap_block_t* heap_start = 0;
+// Heap start and current mapped size
+static unsigned int heap_base = 0;
 static unsigned int heap_size = 0;
+static spinlock_t heap_lock;
+
+// Segregated free lists
+static heap_block_t* free_lists[HEAP_NUM_CLASSES];
+static unsigned int free_class_bitmap = 0;
+
+// Running totals (block sizes, tags included)
+static unsigned int heap_used = 0;
+static unsigned int heap_free = 0;
+
+// Per-owner live bytes, peak live bytes and allocation counts
+static unsigned int owner_live[MEM_TAG_COUNT];
+static unsigned int owner_peak[MEM_TAG_COUNT];
+static unsigned int owner_allocs[MEM_TAG_COUNT];
+
+// ── Boundary tags ───────────────────────────────────────────────────────────
+
+static unsigned int block_size(heap_block_t* block) {
+    return block->header & ~(HEAP_ALIGN - 1);
+}
+
+static int block_is_used(heap_block_t* block) {
+    return block->header & HEAP_USED;
+}
+
+static unsigned int* block_footer(heap_block_t* block) {
+    return (unsigned int*)((char*)block + block_size(block) - HEAP_TAG_SIZE);
+}
+
+static void block_set(heap_block_t* block, unsigned int size, unsigned int used) {
+    block->header = size | used;
+    *block_footer(block) = size | used;
+}
+
+// Mark a block used; its footer records the owner instead of the size
+static void block_set_used(heap_block_t* block, unsigned int size, unsigned int owner) {
+    block->header = size | HEAP_USED;
+    *block_footer(block) = (owner << HEAP_OWNER_SHIFT) | HEAP_USED;
+}
+
+static unsigned int block_owner(heap_block_t* block) {
+    return *block_footer(block) >> HEAP_OWNER_SHIFT;
+}
+
+static void owner_charge(unsigned int owner, unsigned int bytes) {
+    owner_live[owner] += bytes;
+    if (owner_live[owner] > owner_peak[owner]) owner_peak[owner] = owner_live[owner];
+}
+
+static heap_block_t* block_next(heap_block_t* block) {
+    return (heap_block_t*)((char*)block + block_size(block));
+}
+
+// Footer of the previous block sits right before our header
+static unsigned int block_prev_tag(heap_block_t* block) {
+    return *((unsigned int*)block - 1);
+}
+
+// ── Size classes ────────────────────────────────────────────────────────────
+
+static unsigned int size_class(unsigned int size) {
+    if (size <= HEAP_EXACT_MAX) return size / HEAP_ALIGN - 2;
+    unsigned int bit = 31 - __builtin_clz(size);
+    unsigned int cls = HEAP_EXACT_CLASSES + bit - 7;
+    return cls < HEAP_NUM_CLASSES ? cls : HEAP_NUM_CLASSES - 1;
+}
+
+static void free_list_insert(heap_block_t* block) {
+    unsigned int cls = size_class(block_size(block));
+    block->prev = 0;
+    block->next = free_lists[cls];
+    if (free_lists[cls]) free_lists[cls]->prev = block;
+    free_lists[cls] = block;
+    free_class_bitmap |= 1u << cls;
+}
+
+static void free_list_remove(heap_block_t* block) {
+    unsigned int cls = size_class(block_size(block));
+    if (block->prev) block->prev->next = block->next;
+    else free_lists[cls] = block->next;
+    if (block->next) block->next->prev = block->prev;
+    if (!free_lists[cls]) free_class_bitmap &= ~(1u << cls);
+}
+
+// Find a free block of at least size bytes
+static heap_block_t* find_free_block(unsigned int size) {
+    unsigned int cls = size_class(size);
+
+    // Exact classes hold one size, so any block at or above cls fits.
+    // A power-of-two class may hold smaller blocks, so start one higher.
+    unsigned int first = (cls < HEAP_EXACT_CLASSES) ? cls : cls + 1;
+    unsigned int mask = (first < HEAP_NUM_CLASSES) ?
+                        free_class_bitmap & (~0u << first) : 0;
+    if (mask) return free_lists[__builtin_ctz(mask)];
+
+    // Fall back to a first-fit walk of the request's own class
+    for (heap_block_t* block = free_lists[cls]; block; block = block->next) {
+        if (block_size(block) >= size) return block;
+    }
+    return 0;
+}
+
+static void heap_unmap_pages(unsigned int from, unsigned int to);
+
+// Map pages [heap_base + from, heap_base + to) to fresh frames.
+// Returns 0 and leaves nothing mapped if the PMM runs dry.
+static int heap_map_pages(unsigned int from, unsigned int to) {
+    for (unsigned int off = from; off < to; off += HEAP_PAGE_SIZE) {
+        unsigned int frame = pmm_alloc_page_tagged(MEM_TAG_HEAP);
+        if (!frame) {
+            heap_unmap_pages(from, off);
+            return 0;
+        }
+        map_page(heap_base + off, frame, 1, 1);
+    }
+    return 1;
+}
+
+static void heap_unmap_pages(unsigned int from, unsigned int to) {
+    if (from >= to) return;
+    // One TLB flush (and shootdown) covers the whole run
+    unmap_range_free(heap_base + from, to - from);
+}
+
+// Insert a free block, merging with a free block just before it
+static void heap_insert_merge_prev(heap_block_t* block, unsigned int size) {
+    unsigned int prev_tag = block_prev_tag(block);
+    if (!(prev_tag & HEAP_USED)) {
+        heap_block_t* prev = (heap_block_t*)((char*)block - (prev_tag & ~(HEAP_ALIGN - 1)));
+        free_list_remove(prev);
+        size += block_size(prev);
+        block = prev;
+    }
+    block_set(block, size, 0);
+    free_list_insert(block);
+}
+
+// Extend the heap so a block of at least size bytes becomes free at the tail
+static int heap_grow(unsigned int size) {
+    unsigned int grow = (size + HEAP_PAGE_SIZE - 1) & ~(HEAP_PAGE_SIZE - 1);
+    if (heap_size + grow > KHEAP_MAX_SIZE) return 0;
+    if (!heap_map_pages(heap_size, heap_size + grow)) return 0;
+
+    // The old epilogue becomes the header of the new free block
+    heap_block_t* block = (heap_block_t*)(heap_base + heap_size - HEAP_TAG_SIZE);
+    heap_size += grow;
+    *(unsigned int*)(heap_base + heap_size - HEAP_TAG_SIZE) = HEAP_USED;
+    heap_free += grow;
+    heap_insert_merge_prev(block, grow);
+    return 1;
+}
+
+// Give whole idle pages at the end of the heap back to the PMM
+static void heap_shrink(heap_block_t* tail) {
+    unsigned int start = (unsigned int)tail - heap_base;
+    // Keep at least a minimum block in front of the new epilogue
+    unsigned int new_size = (start + HEAP_MIN_BLOCK + HEAP_TAG_SIZE + HEAP_PAGE_SIZE - 1) &
+                            ~(HEAP_PAGE_SIZE - 1);
+    if (new_size < KHEAP_INITIAL_SIZE) new_size = KHEAP_INITIAL_SIZE;
+    if (new_size + HEAP_SHRINK_PAGES * HEAP_PAGE_SIZE > heap_size) return;
+
+    free_list_remove(tail);
+    heap_free -= heap_size - new_size;
+    heap_unmap_pages(new_size, heap_size);
+    heap_size = new_size;
+    *(unsigned int*)(heap_base + heap_size - HEAP_TAG_SIZE) = HEAP_USED;
+    block_set(tail, heap_size - HEAP_TAG_SIZE - start, 0);
+    free_list_insert(tail);
+}
+
+// Take a free block off its list and mark the first size bytes used,
+// returning any usable remainder to the free lists
+static void* heap_use_block(heap_block_t* block, unsigned int size, unsigned int owner) {
+    unsigned int total = block_size(block);
+
+    // Split block if the remainder can hold a block of its own
+    if (total - size >= HEAP_MIN_BLOCK) {
+        heap_block_t* rest = (heap_block_t*)((char*)block + size);
+        block_set(rest, total - size, 0);
+        free_list_insert(rest);
+        total = size;
+    }
+
+    block_set_used(block, total, owner);
+    heap_used += total;
+    heap_free -= total;
+    owner_charge(owner, total);
+    owner_allocs[owner]++;
+    return (char*)block + HEAP_TAG_SIZE;
+}
+
+static unsigned int heap_block_size_for(unsigned int size) {
+    // Room for both tags, rounded to the heap alignment
+    size = (size + 2 * HEAP_TAG_SIZE + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+    return size < HEAP_MIN_BLOCK ? HEAP_MIN_BLOCK : size;
+}
 
 // Initialize heap
 void heap_init() {
     print_string("[OK] Initializing Heap Allocator...\n");
-    
-    // Allocate 16 pages (64KB) for heap
-    unsigned int heap_pages = 16;
-    unsigned int heap_addr = pmm_alloc_pages(heap_pages);
-    
-    if (heap_addr == 0) {
+
+    // Map the initial heap into its reserved virtual range; the frames
+    // behind it need not be contiguous
+    spin_lock_init(&heap_lock, "heap");
+    heap_base = KHEAP_START;
+    heap_size = 0;
+    if (!heap_map_pages(0, KHEAP_INITIAL_SIZE)) {
         print_string("[ERROR] Failed to allocate heap memory!\n");
         return;
     }
-    
-    heap_start = (heap_block_t*)heap_addr;
-    heap_size = heap_pages * 4096;
-    
-    // Initialize first block
-    heap_start->size = heap_size - sizeof(heap_block_t);
-    heap_start->is_free = 1;
-    heap_start->next = 0;
-    
+
+    heap_size = KHEAP_INITIAL_SIZE;
+    for (int i = 0; i < HEAP_NUM_CLASSES; i++) {
+        free_lists[i] = 0;
+    }
+    free_class_bitmap = 0;
+
+    // A used prologue tag and a zero-sized used epilogue fence the heap,
+    // so coalescing never needs bounds checks. Payloads end up 8-aligned.
+    *(unsigned int*)heap_base = HEAP_USED;
+    *(unsigned int*)(heap_base + heap_size - HEAP_TAG_SIZE) = HEAP_USED;
+
+    heap_block_t* first = (heap_block_t*)(heap_base + HEAP_TAG_SIZE);
+    block_set(first, heap_size - 2 * HEAP_TAG_SIZE, 0);
+    free_list_insert(first);
+    heap_used = 0;
+    heap_free = block_size(first);
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        owner_live[i] = owner_peak[i] = owner_allocs[i] = 0;
+    }
+
     print_string("  Heap size: ");
     print_dec(heap_size / 1024);
-    print_string(" KB\n");
+    print_string(" KB (max ");
+    print_dec(KHEAP_MAX_SIZE / 1024);
+    print_string(" KB)\n");
     print_string("  Heap address: ");
-    print_hex(heap_addr);
+    print_hex(heap_base);
     print_string("\n");
+    print_string("  Size classes: ");
+    print_dec(HEAP_NUM_CLASSES);
+    print_string(" (segregated fit)\n");
     print_string("[OK] Heap Allocator initialized\n");
 }
 
 // Allocate memory from heap
 void* kmalloc(unsigned int size) {
-    if (size == 0) return 0;
-    
-    // Align size to 4 bytes
-    size = (size + 3) & ~3;
-    
-    heap_block_t* current = heap_start;
-    
-    while (current) {
-        if (current->is_free && current->size >= size) {
-            // Found suitable block
-            
-            // Split block if there's enough space
-            if (current->size >= size + sizeof(heap_block_t) + 4) {
-                heap_block_t* new_block = (heap_block_t*)((char*)current + sizeof(heap_block_t) + size);
-                new_block->size = current->size - size - sizeof(heap_block_t);
-                new_block->is_free = 1;
-                new_block->next = current->next;
-                
-                current->size = size;
-                current->next = new_block;
-            }
-            
-            current->is_free = 0;
-            return (void*)((char*)current + sizeof(heap_block_t));
-        }
-        
-        current = current->next;
+    return kmalloc_tagged(size, MEM_TAG_OTHER);
+}
+
+// Find and take a block of size bytes (tags included); heap_lock held
+static void* heap_alloc(unsigned int size, unsigned int tag) {
+    heap_block_t* block = find_free_block(size);
+    if (!block) {
+        if (!heap_grow(size)) return 0;  // Out of memory
+        block = find_free_block(size);
+        if (!block) return 0;
     }
-    
-    // No suitable block found
-    return 0;
+
+    free_list_remove(block);
+    return heap_use_block(block, size, tag);
 }
 
-// Free memory
-void kfree(void* ptr) {
-    if (!ptr) return;
-    
-    heap_block_t* block = (heap_block_t*)((char*)ptr - sizeof(heap_block_t));
-    block->is_free = 1;
-    
+// Allocate memory accounted to a MEM_TAG_* owner
+void* kmalloc_tagged(unsigned int size, unsigned int tag) {
+    if (size == 0 || size > KHEAP_MAX_SIZE) return 0;
+    if (tag >= MEM_TAG_COUNT) tag = MEM_TAG_OTHER;
+    size = heap_block_size_for(size);
+
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = heap_alloc(size, tag);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+// Allocate memory whose address is a multiple of align (a power of two)
+void* kmalloc_aligned(unsigned int size, unsigned int align) {
+    if (align <= HEAP_ALIGN) return kmalloc(size);
+    if (size == 0 || size > KHEAP_MAX_SIZE || (align & (align - 1))) return 0;
+    size = heap_block_size_for(size);
+
+    // Leave room to split off a leading free block before the aligned one
+    unsigned int search = size + align + HEAP_MIN_BLOCK;
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+    heap_block_t* block = find_free_block(search);
+    if (!block && heap_grow(search)) block = find_free_block(search);
+    if (!block) {
+        spin_unlock_irqrestore(&heap_lock, flags);
+        return 0;
+    }
+    free_list_remove(block);
+
+    unsigned int payload = (unsigned int)block + HEAP_TAG_SIZE;
+    unsigned int aligned = (payload + align - 1) & ~(align - 1);
+    while (aligned != payload && aligned - payload < HEAP_MIN_BLOCK) aligned += align;
+
+    if (aligned != payload) {
+        unsigned int lead = aligned - payload;
+        heap_block_t* rest = (heap_block_t*)((char*)block + lead);
+        block_set(rest, block_size(block) - lead, 0);
+        block_set(block, lead, 0);
+        free_list_insert(block);
+        block = rest;
+    }
+    void* ptr = heap_use_block(block, size, MEM_TAG_OTHER);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+// Return a used block to the free lists; heap_lock held
+static void heap_release(void* ptr) {
+    heap_block_t* block = (heap_block_t*)((char*)ptr - HEAP_TAG_SIZE);
+    if (!block_is_used(block)) return;  // double free
+
+    unsigned int size = block_size(block);
+    heap_used -= size;
+    heap_free += size;
+    owner_live[block_owner(block)] -= size;
+
     // Merge with next block if it's free
-    if (block->next && block->next->is_free) {
-        block->size += sizeof(heap_block_t) + block->next->size;
-        block->next = block->next->next;
+    heap_block_t* next = block_next(block);
+    if (!block_is_used(next)) {
+        free_list_remove(next);
+        size += block_size(next);
     }
-    
+
     // Merge with previous block if it's free
-    heap_block_t* current = heap_start;
-    while (current && current->next != block) {
-        current = current->next;
+    unsigned int prev_tag = block_prev_tag(block);
+    if (!(prev_tag & HEAP_USED)) {
+        heap_block_t* prev = (heap_block_t*)((char*)block - (prev_tag & ~(HEAP_ALIGN - 1)));
+        free_list_remove(prev);
+        size += block_size(prev);
+        block = prev;
+    }
+
+    block_set(block, size, 0);
+    free_list_insert(block);
+
+    // A free block touching the epilogue may let the heap shrink
+    if ((unsigned int)block + size == heap_base + heap_size - HEAP_TAG_SIZE) {
+        heap_shrink(block);
+    }
+}
+
+// Free memory
+void kfree(void* ptr) {
+    if (!ptr) return;
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+    heap_release(ptr);
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+// Resize an allocation, in place when the block or its free neighbour allows
+void* krealloc(void* ptr, unsigned int size) {
+    if (!ptr) return kmalloc(size);
+    if (size == 0) { kfree(ptr); return 0; }
+    if (size > KHEAP_MAX_SIZE) return 0;
+
+    heap_block_t* block = (heap_block_t*)((char*)ptr - HEAP_TAG_SIZE);
+    unsigned int new_size = heap_block_size_for(size);
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+    unsigned int old_size = block_size(block);
+    unsigned int owner = block_owner(block);
+
+    // Absorb a free neighbour after us if that makes the block big enough
+    heap_block_t* next = block_next(block);
+    if (new_size > old_size && !block_is_used(next) &&
+        old_size + block_size(next) >= new_size) {
+        free_list_remove(next);
+        heap_free -= block_size(next);
+        heap_used += block_size(next);
+        owner_charge(owner, block_size(next));
+        old_size += block_size(next);
+        block_set_used(block, old_size, owner);
     }
-    
-    if (current && current->is_free) {
-        current->size += sizeof(heap_block_t) + block->size;
-        current->next = block->next;
+
+    if (new_size <= old_size) {
+        // Shrink in place, returning the tail if it can stand alone
+        if (old_size - new_size >= HEAP_MIN_BLOCK) {
+            heap_block_t* rest = (heap_block_t*)((char*)block + new_size);
+            block_set_used(block, new_size, owner);
+            // Release the tail as a block so it merges with whatever follows
+            block_set_used(rest, old_size - new_size, owner);
+            heap_release((char*)rest + HEAP_TAG_SIZE);
+        }
+        spin_unlock_irqrestore(&heap_lock, flags);
+        return ptr;
     }
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    // Move: allocate, copy the old payload, release the old block
+    unsigned char* dst = (unsigned char*)kmalloc_tagged(size, owner);
+    if (!dst) return 0;
+    unsigned char* src = (unsigned char*)ptr;
+    unsigned int copy = old_size - 2 * HEAP_TAG_SIZE;
+    for (unsigned int i = 0; i < copy; i++) dst[i] = src[i];
+    kfree(ptr);
+    return dst;
 }
 
 // Get heap statistics
 void heap_get_stats(unsigned int* total, unsigned int* used, unsigned int* free) {
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
     *total = heap_size;
-    *used = 0;
-    *free = 0;
-    
-    heap_block_t* current = heap_start;
-    while (current) {
-        if (current->is_free) {
-            *free += current->size;
-        } else {
-            *used += current->size;
+    *used = heap_used;
+    *free = heap_free;
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+// Largest free block; only the highest non-empty class is walked
+static unsigned int heap_largest_free() {
+    if (!free_class_bitmap) return 0;
+    unsigned int cls = 31 - __builtin_clz(free_class_bitmap);
+    unsigned int largest = 0;
+    for (heap_block_t* block = free_lists[cls]; block; block = block->next) {
+        if (block_size(block) > largest) largest = block_size(block);
+    }
+    return largest;
+}
+
+// Get the largest free block
+unsigned int heap_get_largest_free() {
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+    unsigned int largest = heap_largest_free();
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return largest;
+}
+
+// Fragmentation in percent: 0 when all free memory is one block
+unsigned int heap_get_fragmentation() {
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+    unsigned int largest = heap_largest_free();
+    unsigned int free = heap_free;
+    spin_unlock_irqrestore(&heap_lock, flags);
+    if (free == 0) return 0;
+    // Scale down so the percentage math can't overflow 32 bits
+    while (free > 0x01000000) { largest >>= 4; free >>= 4; }
+    return 100 - (largest * 100) / free;
+}
+
+// Live bytes, peak live bytes and allocation count for a MEM_TAG_* owner
+void heap_get_tag_stats(unsigned int tag, unsigned int* live, unsigned int* peak,
+                        unsigned int* allocs) {
+    if (tag >= MEM_TAG_COUNT) tag = MEM_TAG_OTHER;
+    if (live) *live = owner_live[tag];
+    if (peak) *peak = owner_peak[tag];
+    if (allocs) *allocs = owner_allocs[tag];
+}
+
+// Count free blocks by size: bucket i holds sizes [16 << i, 32 << i),
+// the last bucket everything larger
+void heap_get_free_histogram(unsigned int* counts) {
+    for (int i = 0; i < HEAP_HIST_BUCKETS; i++) counts[i] = 0;
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+    for (int cls = 0; cls < HEAP_NUM_CLASSES; cls++) {
+        for (heap_block_t* block = free_lists[cls]; block; block = block->next) {
+            unsigned int bucket = (31 - __builtin_clz(block_size(block))) - 4;
+            if (bucket >= HEAP_HIST_BUCKETS) bucket = HEAP_HIST_BUCKETS - 1;
+            counts[bucket]++;
         }
-        current = current->next;
     }
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
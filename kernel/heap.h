@@ -4,14 +4,33 @@
 #ifndef HEAP_H
 #define HEAP_H
 
+// Reserved kernel virtual range for the heap
+#define KHEAP_START         0xC0000000
+#define KHEAP_INITIAL_SIZE  (16 * 4096)
+#define KHEAP_MAX_SIZE      0x04000000
+
+// Free-block size histogram: 16 bytes .. 8KB and up
+#define HEAP_HIST_BUCKETS   10
+
 // Initialize heap
 void heap_init();
 
 // Memory allocation
 void* kmalloc(unsigned int size);
+void* kmalloc_tagged(unsigned int size, unsigned int tag);  // MEM_TAG_* owner
+// Aligned in virtual memory only: the heap grows by single frames, so a
+// buffer over one page need not be physically contiguous and is not safe
+// for DMA. Device buffers come from pmm_alloc_pages.
+void* kmalloc_aligned(unsigned int size, unsigned int align);
+void* krealloc(void* ptr, unsigned int size);
 void kfree(void* ptr);
 
 // Statistics
 void heap_get_stats(unsigned int* total, unsigned int* used, unsigned int* free);
+unsigned int heap_get_largest_free();
+unsigned int heap_get_fragmentation();
+void heap_get_tag_stats(unsigned int tag, unsigned int* live, unsigned int* peak,
+                        unsigned int* allocs);
+void heap_get_free_histogram(unsigned int* counts);
 
 #endif
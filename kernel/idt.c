@@ -6,6 +6,11 @@
 #include "paging.h"
 #include "timer.h"
 #include "keyboard.h"
+#include "ata.h"
+#include "process.h"
+#include "fpu.h"
+#include "apic.h"
+#include "smp.h"
 
 extern void idt_load();
 extern void idt_set_gate(unsigned char num, unsigned long base, unsigned short sel, unsigned char flags);
@@ -25,6 +30,8 @@ extern void irq0(); extern void irq1(); extern void irq2(); extern void irq3();
 extern void irq4(); extern void irq5(); extern void irq6(); extern void irq7();
 extern void irq8(); extern void irq9(); extern void irq10(); extern void irq11();
 extern void irq12(); extern void irq13(); extern void irq14(); extern void irq15();
+extern void irq16(); extern void irq17(); extern void irq18();
+extern void apic_spurious();
 
 // System call handler
 extern void syscall_entry();
@@ -100,12 +107,21 @@ void idt_init() {
     idt_set_gate(45, (unsigned long)irq13, 0x08, 0x8E);
     idt_set_gate(46, (unsigned long)irq14, 0x08, 0x8E);
     idt_set_gate(47, (unsigned long)irq15, 0x08, 0x8E);
+    // Local APIC vectors
+    idt_set_gate(APIC_TIMER_VECTOR, (unsigned long)irq16, 0x08, 0x8E);
+    idt_set_gate(APIC_TLB_VECTOR, (unsigned long)irq17, 0x08, 0x8E);
+    idt_set_gate(APIC_WAKE_VECTOR, (unsigned long)irq18, 0x08, 0x8E);
+    idt_set_gate(APIC_SPURIOUS_VECTOR, (unsigned long)apic_spurious, 0x08, 0x8E);
     // Set up system call handler (INT 0x80)
     idt_set_gate(0x80, (unsigned long)syscall_entry, 0x08, 0xEE);
     idt_load();
 }
 
 void isr_handler(unsigned int int_no, unsigned int err_code) {
+    if (int_no == 7) {
+        fpu_trap();     // lazy FPU switch, not an error
+        return;
+    }
     if (int_no == 14) {
         unsigned int faulting_address;
         asm volatile("mov %%cr2, %0" : "=r"(faulting_address));
@@ -134,25 +150,39 @@ void irq_handler(unsigned int irq_no, unsigned int err_code) {
         case 33:  // IRQ1 - Keyboard
             keyboard_handler();
             break;
+        case 46:  // IRQ14 - Primary ATA
+        case 47:  // IRQ15 - Secondary ATA
+            ata_irq_handler(irq_no - 46);
+            break;
+        case APIC_TIMER_VECTOR:  // Tick of a CPU without the PIT
+            scheduler_tick();
+            break;
+        case APIC_TLB_VECTOR:    // Another CPU changed kernel mappings
+            smp_tlb_poll();
+            break;
+        case APIC_WAKE_VECTOR:   // Only here to end a hlt
+            break;
         default:
             // Unhandled IRQ
             break;
     }
     
-    // Send EOI (End of Interrupt) to PIC
-    if (irq_no >= 40) {
-        // Send EOI to slave PIC for IRQ8-15
-        outb(0xA0, 0x20);
+    if (irq_no >= APIC_TIMER_VECTOR) {
+        apic_eoi();
+    } else {
+        // Send EOI (End of Interrupt) to PIC
+        if (irq_no >= 40) {
+            // Send EOI to slave PIC for IRQ8-15
+            outb(0xA0, 0x20);
+        }
+        // Always send EOI to master PIC
+        outb(0x20, 0x20);
     }
-    // Always send EOI to master PIC
-    outb(0x20, 0x20);
-void irq_handler(unsigned int irq_no, unsigned int err_code) {
-    // Send EOI (End of Interrupt) signal to PIC
-    if (irq_no >= 40) {
-        outb(0xA0, 0x20);  // Send EOI to slave PIC
+
+    // Preempt once the tick is acknowledged, so the next process gets
+    // timer interrupts. The interrupted context resumes through the
+    // stub's iret when this process is switched back in.
+    if ((irq_no == 32 || irq_no == APIC_TIMER_VECTOR) && scheduler_need_resched()) {
+        schedule_preempt();
     }
-    outb(0x20, 0x20);      // Send EOI to master PIC
-    
-    // Handle specific IRQs here if needed
-    // For now, just acknowledge the interrupt
 }
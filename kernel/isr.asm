@@ -85,27 +85,40 @@ IRQ 12, 44  ; PS2 Mouse
 IRQ 13, 45  ; FPU
 IRQ 14, 46  ; Primary ATA
 IRQ 15, 47  ; Secondary ATA
+IRQ 16, 64  ; Local APIC timer (APIC_TIMER_VECTOR)
+IRQ 17, 65  ; TLB shootdown IPI (APIC_TLB_VECTOR)
+IRQ 18, 66  ; Wakeup IPI (APIC_WAKE_VECTOR)
+
+; Per-CPU data selector (gdt.h GDT_PERCPU)
+PERCPU_SEL equ 0x30
 
 ; Common ISR stub
+; Stack on entry to the C handler: its two arguments, then the saved GS
+; and DS, the pusha block, the interrupt number and error code
 isr_common_stub:
     pusha              ; Push all general purpose registers
     
     mov ax, ds
     push eax           ; Save data segment
+    push gs            ; Save GS (user's, or this CPU's)
     
     mov ax, 0x10       ; Load kernel data segment
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, PERCPU_SEL ; GS reaches this CPU's data
     mov gs, ax
     
+    push dword [esp+44] ; error code
+    push dword [esp+44] ; interrupt number
     call isr_handler   ; Call C handler
+    add esp, 8
     
+    pop gs
     pop eax            ; Restore data segment
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
     popa               ; Pop all general purpose registers
     add esp, 8         ; Clean up error code and interrupt number
@@ -118,22 +131,32 @@ irq_common_stub:
     
     mov ax, ds
     push eax
+    push gs
     
     mov ax, 0x10
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, PERCPU_SEL
     mov gs, ax
     
+    push dword [esp+44] ; error code
+    push dword [esp+44] ; IRQ number
     call irq_handler
+    add esp, 8
     
+    pop gs
     pop eax
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     
     popa
     add esp, 8
     sti
     iret
+
+; Local APIC spurious interrupt: no handler and no EOI
+global apic_spurious
+apic_spurious:
+    iret
@@ -9,9 +9,16 @@
 #include "pmm.h"
 #include "heap.h"
 #include "paging.h"
+#include "vma.h"
+#include "vmalloc.h"
+#include "acpi.h"
+#include "clock.h"
 #include "process.h"
 #include "syscall.h"
+#include "futex.h"
 #include "tss.h"
+#include "fpu.h"
+#include "smp.h"
 #include "ata.h"
 #include "fs.h"
 #include "shell.h"
@@ -127,17 +134,25 @@ void kernel_main(void) {
     clear_screen();
     print_string("[BOOT] SUB OS v0.11.0 starting...\n");
 
+    smp_init_bsp();
     idt_init();
     timer_init();
     keyboard_init();
     memory_init();
     pmm_init();
-    heap_init();
     paging_init();
+    heap_init();
+    vma_init();
+    vmalloc_init();
+    acpi_init();
+    clock_init();
     tss_init();
+    fpu_init();
     syscall_init();
+    futex_init();
     process_init();
     scheduler_init();
+    smp_init();
     ata_init();
     fs_init();
     fs_mount();
@@ -2,6 +2,8 @@
 // Copyright (c) 2025 SUB OS Project
 
 #include "keyboard.h"
+#include "spinlock.h"
+#include "wait.h"
 #include "kernel.h"
 
 #define KEYBOARD_DATA_PORT   0x60
@@ -47,20 +49,38 @@ unsigned char keyboard_map[128] = {
 static char  kb_buf[KB_BUF_SIZE];
 static int   kb_head = 0;   // read  pointer
 static int   kb_tail = 0;   // write pointer
+static spinlock_t kb_lock;  // IRQ1 fills the ring, any CPU may drain it
+static wait_queue_t kb_wait_queue;  // readers sleeping on an empty ring
 
+// Called from IRQ1, interrupts already off
 static void kb_buf_push(char c) {
+    spin_lock(&kb_lock);
     int next = (kb_tail + 1) % KB_BUF_SIZE;
     if (next != kb_head) {          // drop if full
         kb_buf[kb_tail] = c;
         kb_tail = next;
     }
+    spin_unlock(&kb_lock);
 }
 
 // Returns 0 if buffer is empty, otherwise pops and returns the char.
 char keyboard_getchar(void) {
+    // Cheap unlocked peek: callers poll this in loops
     if (kb_head == kb_tail) return 0;
-    char c = kb_buf[kb_head];
-    kb_head = (kb_head + 1) % KB_BUF_SIZE;
+    unsigned int flags = spin_lock_irqsave(&kb_lock);
+    char c = 0;
+    if (kb_head != kb_tail) {
+        c = kb_buf[kb_head];
+        kb_head = (kb_head + 1) % KB_BUF_SIZE;
+    }
+    spin_unlock_irqrestore(&kb_lock, flags);
+    return c;
+}
+
+// Block until a key arrives and return it
+char keyboard_wait(void) {
+    char c;
+    wait_event(&kb_wait_queue, (c = keyboard_getchar()) != 0);
     return c;
 }
 
@@ -69,11 +89,16 @@ void keyboard_handler(void) {
     unsigned char sc = inb(KEYBOARD_DATA_PORT);
     if (sc & 0x80) return;   // key-release: ignore
     char c = keyboard_map[sc & 0x7F];
-    if (c) kb_buf_push(c);
+    if (c) {
+        kb_buf_push(c);
+        wake_up_all(&kb_wait_queue);
+    }
 }
 
 // ── Init ────────────────────────────────────────────────────────────────────
 void keyboard_init(void) {
+    spin_lock_init(&kb_lock, "keyboard");
+    wait_queue_init(&kb_wait_queue);
     kb_head = kb_tail = 0;
     print_string("[OK] Keyboard driver initialized\n");
 }
@@ -7,5 +7,6 @@
 void keyboard_init(void);
 void keyboard_handler(void);
 char keyboard_getchar(void);
+char keyboard_wait(void);
 
 #endif
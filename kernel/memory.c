@@ -10,13 +10,17 @@
 // REMOVE DUPLICATE memory_map_entry_t struct (now only in memory.h)
 
 // Memory statistics
-static unsigned long total_memory = 0;
-static unsigned long usable_memory = 0;
-static unsigned long reserved_memory = 0;
+static unsigned long long total_memory = 0;
+static unsigned long long usable_memory = 0;
+static unsigned long long reserved_memory = 0;
 
 // Memory map entry count
 static unsigned int memory_map_entries = 0;
 
+// Usable RAM, sorted by base, merged, page aligned
+static memory_region_t regions[MEMORY_MAX_REGIONS];
+static unsigned int region_count = 0;
+
 // Memory types
 const char* memory_type_names[] = {
     "Unknown",
@@ -32,20 +36,99 @@ const char* get_memory_type_name(unsigned int type) {
     return memory_type_names[type];
 }
 
+static unsigned long long entry_base(const memory_map_entry_t* entry) {
+    return ((unsigned long long)entry->base_high << 32) | entry->base_low;
+}
+
+static unsigned long long entry_length(const memory_map_entry_t* entry) {
+    return ((unsigned long long)entry->length_high << 32) | entry->length_low;
+}
+
+static void region_delete(unsigned int index) {
+    for (unsigned int i = index; i + 1 < region_count; i++) regions[i] = regions[i + 1];
+    region_count--;
+}
+
+static int region_insert(unsigned int index, unsigned long long base, unsigned long long end) {
+    if (region_count == MEMORY_MAX_REGIONS) {
+        print_string("[WARN] Too many memory regions, ignoring some RAM\n");
+        return 0;
+    }
+    for (unsigned int i = region_count; i > index; i--) regions[i] = regions[i - 1];
+    regions[index].base = base;
+    regions[index].end = end;
+    region_count++;
+    return 1;
+}
+
+// Add usable RAM [base, end), shrunk to whole pages, merging with any
+// region it overlaps or touches
+static void region_add(unsigned long long base, unsigned long long end) {
+    base = (base + 0xFFF) & ~0xFFFULL;
+    end &= ~0xFFFULL;
+    if (base >= end) return;
+
+    unsigned int i = 0;
+    while (i < region_count && regions[i].end < base) i++;
+    if (i == region_count || regions[i].base > end) {
+        region_insert(i, base, end);
+        return;
+    }
+
+    if (base < regions[i].base) regions[i].base = base;
+    if (end > regions[i].end) regions[i].end = end;
+    while (i + 1 < region_count && regions[i + 1].base <= regions[i].end) {
+        if (regions[i + 1].end > regions[i].end) regions[i].end = regions[i + 1].end;
+        region_delete(i + 1);
+    }
+}
+
+// Cut [base, end), grown to whole pages, out of the usable regions.
+// Firmware maps may overlap, and a reserved range always wins.
+static void region_remove(unsigned long long base, unsigned long long end) {
+    base &= ~0xFFFULL;
+    end = (end + 0xFFF) & ~0xFFFULL;
+    if (base >= end) return;
+
+    unsigned int i = 0;
+    while (i < region_count) {
+        memory_region_t* r = &regions[i];
+        if (r->end <= base || r->base >= end) {
+            i++;
+        } else if (r->base < base && r->end > end) {
+            unsigned long long tail = r->end;
+            r->end = base;
+            region_insert(i + 1, end, tail);
+            i += 2;
+        } else if (r->base < base) {
+            r->end = base;
+            i++;
+        } else if (r->end > end) {
+            r->base = end;
+            i++;
+        } else {
+            region_delete(i);
+        }
+    }
+}
+
 void memory_init() {
     print_string("[OK] Detecting memory...\n");
     memory_map_entry_t* entries = (memory_map_entry_t*)MEMORY_MAP_ADDR;
     memory_map_entries = *(unsigned short*)(MEMORY_MAP_ADDR + 24 * 100);
+    if (memory_map_entries > 100) memory_map_entries = 100;
     if (memory_map_entries == 0) {
         print_string("[WARN] No memory map, assuming 32MB\n");
         total_memory = 32 * 1024 * 1024;
-        usable_memory = 32 * 1024 * 1024;
+        region_add(0, 0x9F000);
+        region_add(0x100000, total_memory);
+        usable_memory = 0x9F000 + total_memory - 0x100000;
         return;
     }
     print_string("Memory Map (");
     print_hex(memory_map_entries);
     print_string(" entries):\n");
-    for (unsigned int i = 0; i < memory_map_entries && i < 100; i++) {
+    for (unsigned int i = 0; i < memory_map_entries; i++) {
         memory_map_entry_t* entry = &entries[i];
         print_string("  ");
         print_hex((unsigned int)(entry->base_low));
@@ -56,35 +139,60 @@ void memory_init() {
         print_string(" : ");
         print_string(get_memory_type_name(entry->type));
         print_string("\n");
-        unsigned long length = (unsigned long)(entry->length_low);
+        unsigned long long length = entry_length(entry);
         total_memory += length;
-        if (entry->type == 1) {
-            usable_memory += length;
+        if (entry->type == MEMORY_USABLE) {
+            region_add(entry_base(entry), entry_base(entry) + length);
         } else {
             reserved_memory += length;
         }
     }
+    // Second pass so holes, ACPI and reserved ranges punch through any
+    // usable entry they overlap, whatever order the firmware listed them in
+    for (unsigned int i = 0; i < memory_map_entries; i++) {
+        memory_map_entry_t* entry = &entries[i];
+        if (entry->type != MEMORY_USABLE) {
+            region_remove(entry_base(entry), entry_base(entry) + entry_length(entry));
+        }
+    }
+
+    print_string("Usable regions:\n");
+    for (unsigned int i = 0; i < region_count; i++) {
+        usable_memory += regions[i].end - regions[i].base;
+        print_string("  ");
+        print_hex((unsigned int)(regions[i].base >> 32));
+        print_hex((unsigned int)regions[i].base);
+        print_string(" - ");
+        print_hex((unsigned int)(regions[i].end >> 32));
+        print_hex((unsigned int)regions[i].end);
+        print_string("\n");
+    }
+
     print_string("\nMemory Summary:\n");
     print_string("  Total: ");
-    print_hex(total_memory / 1024);
-    print_string(" KB (");
-    print_hex(total_memory / (1024 * 1024));
-    print_string(" MB)\n");
+    print_dec((unsigned int)(total_memory >> 20));
+    print_string(" MB\n");
     print_string("  Usable: ");
-    print_hex(usable_memory / 1024);
+    print_dec((unsigned int)(usable_memory >> 10));
     print_string(" KB (");
-    print_hex(usable_memory / (1024 * 1024));
+    print_dec((unsigned int)(usable_memory >> 20));
     print_string(" MB)\n");
     print_string("  Reserved: ");
-    print_hex(reserved_memory / 1024);
+    print_dec((unsigned int)(reserved_memory >> 10));
     print_string(" KB\n");
     print_string("[OK] Memory detection complete\n");
 }
 
+// Byte counts saturate at 4GB
 unsigned long get_total_memory() {
-    return total_memory;
+    return total_memory > 0xFFFFFFFFULL ? 0xFFFFFFFF : (unsigned long)total_memory;
 }
 
 unsigned long get_usable_memory() {
-    return usable_memory;
+    return usable_memory > 0xFFFFFFFFULL ? 0xFFFFFFFF : (unsigned long)usable_memory;
+}
+
+unsigned int memory_get_regions(const memory_region_t** out) {
+    *out = regions;
+    return region_count;
 }
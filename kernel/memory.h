@@ -4,15 +4,27 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
-// Memory map entry structure
+#define MEMORY_MAX_REGIONS 32
+
+// E820 memory types
+#define MEMORY_USABLE      1
+
+// Memory map entry structure (24 bytes as stored by the bootloader)
 typedef struct {
     unsigned int base_low;
     unsigned int base_high;
     unsigned int length_low;
     unsigned int length_high;
     unsigned int type;
+    unsigned int acpi_attrs;
 } __attribute__((packed)) memory_map_entry_t;
 
+// A page-aligned run of usable RAM, [base, end)
+typedef struct {
+    unsigned long long base;
+    unsigned long long end;
+} memory_region_t;
+
 // Initialize memory detection
 void memory_init();
 
@@ -20,4 +32,8 @@ void memory_init();
 unsigned long get_total_memory();
 unsigned long get_usable_memory();
 
+// Usable RAM as a sorted list of non-overlapping regions, with reserved,
+// ACPI and bad ranges cut out. Returns the number of regions.
+unsigned int memory_get_regions(const memory_region_t** regions);
+
 #endif
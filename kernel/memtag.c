@@ -0,0 +1,12 @@
+// SUB OS - Memory Accounting Tags
+// Copyright (c) 2025 SUB OS Project
+
+#include "memtag.h"
+
+static const char* memtag_names[MEM_TAG_COUNT] = {
+    "other", "process", "fs", "paging", "gui", "slab", "heap", "vmalloc"
+};
+
+const char* memtag_name(unsigned int tag) {
+    return tag < MEM_TAG_COUNT ? memtag_names[tag] : "?";
+}
@@ -0,0 +1,21 @@
+// SUB OS - Memory Accounting Tags
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef MEMTAG_H
+#define MEMTAG_H
+
+// Owner of a heap block or physical page, for per-subsystem accounting
+#define MEM_TAG_OTHER    0
+#define MEM_TAG_PROCESS  1
+#define MEM_TAG_FS       2
+#define MEM_TAG_PAGING   3
+#define MEM_TAG_GUI      4
+#define MEM_TAG_SLAB     5
+#define MEM_TAG_HEAP     6
+#define MEM_TAG_VMALLOC  7
+#define MEM_TAG_COUNT    8
+
+// Short display name of a tag
+const char* memtag_name(unsigned int tag);
+
+#endif
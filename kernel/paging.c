@@ -1,105 +1,432 @@
 // SUB OS - Paging (Virtual Memory)
 // Copyright (c) 2025 SUB OS Project
+//
+// Directories and page tables are plain arrays of entries: 32-bit words
+// by default, 64-bit words in PAE builds (CONFIG_PAE), where a 4-entry
+// PDPT selects one of four 512-entry directories. Each address space maps
+// its own directories into its last PDE slots, so the loaded space
+// exposes all of its PTEs at PTE_BASE and its PDEs at PDE_BASE and any
+// entry is one array index away. Directories that are not loaded (fork,
+// teardown) are reached through the direct map instead.
 
 #include "paging.h"
 #include "pmm.h"
+#include "process.h"
+#include "smp.h"
+#include "vma.h"
 #include "kernel.h"
 
-typedef struct {
-    unsigned int present    : 1;
-    unsigned int rw         : 1;
-    unsigned int user       : 1;
-    unsigned int accessed   : 1;
-    unsigned int dirty      : 1;
-    unsigned int unused     : 7;
-    unsigned int frame      : 20;
-} __attribute__((packed)) page_t;
+#ifdef CONFIG_PAE
+typedef unsigned long long pte_t;
+#define PTES_PER_TABLE   512
+#define PDE_SHIFT        21
+#define LARGE_PAGE_SIZE  0x200000
+#define PTE_FRAME        0x000FFFFFFFFFF000ULL
+#define RECURSIVE_SLOT   2044       // last four PDEs map the four directories
+#define PTE_BASE         0xFF800000
+#define PDE_BASE         0xFFFFC000
+#else
+typedef unsigned int pte_t;
+#define PTES_PER_TABLE   1024
+#define PDE_SHIFT        22
+#define LARGE_PAGE_SIZE  0x400000
+#define PTE_FRAME        PAGE_FRAME
+#define RECURSIVE_SLOT   1023
+#define PTE_BASE         0xFFC00000
+#define PDE_BASE         0xFFFFF000
+#endif
 
-typedef struct {
-    page_t pages[1024];
-} page_table_t;
+#define PDE_LARGE        0x80       // 2MB/4MB page (needs CR4.PSE without PAE)
+#define PDE_TABLE_FLAGS  (PAGE_PRESENT | PAGE_WRITE | PAGE_USER)  // PTEs decide
+#define LOW_MAP_END      0x400000   // first 4MB always uses 4KB pages
+#define CR4_PSE          0x10
+#define CR4_PAE          0x20
+#define CR4_PGE          0x80
+#define CR0_WP           0x10000   // ring 0 honours read-only PTEs too
 
-typedef struct {
-    unsigned int tables_physical[1024];
-    page_table_t* tables[1024];
-} page_directory_t;
+// Batches touching more pages than this flush the whole TLB instead
+#define FLUSH_ALL_PAGES  32
 
-static page_directory_t* kernel_directory = 0;
-static page_directory_t* current_directory = 0;
+// Windows onto user frames outside the direct map (high memory),
+// KMAP_SLOTS per CPU
+#define KMAP_BASE        0xFF000000
+#define KMAP_SLOTS       2
+
+// Page fault error code bits
+#define PF_PRESENT       0x1
+#define PF_WRITE         0x2
+#define PF_USER          0x4
+
+#define USER_PDE_FIRST   (USER_SPACE_START >> PDE_SHIFT)
+#define USER_PDE_LAST    (USER_SPACE_END >> PDE_SHIFT)
+
+static unsigned int kernel_directory = 0;  // physical, the kernel's CR3
+static int paging_enabled = 0;
+
+// 1 when kernel mappings are marked global, i.e. the CPU has PGE
+static unsigned int kernel_global = 0;
+
+// Kernel image boundaries (defined in linker script)
+extern unsigned int kernel_ro_end;
+extern unsigned int kernel_end;
 
 extern void page_fault_handler(unsigned int error_code);
 
-static page_t* get_page(unsigned int address, int make, page_directory_t* dir) {
-    address /= 0x1000;
-    unsigned int table_idx = address / 1024;
-    if (dir->tables[table_idx]) {
-        return &dir->tables[table_idx]->pages[address % 1024];
-    } else if (make) {
-        unsigned int tmp;
-        dir->tables[table_idx] = (page_table_t*)pmm_alloc_page();
-        for (int i = 0; i < 1024; i++) {
-            dir->tables[table_idx]->pages[i].present = 0;
-            dir->tables[table_idx]->pages[i].rw = 1;
-            dir->tables[table_idx]->pages[i].user = 0;
-            dir->tables[table_idx]->pages[i].frame = 0;
+static int is_user_address(unsigned int address) {
+    return address >= USER_SPACE_START && address < USER_SPACE_END;
+}
+
+static unsigned int read_cr3(void) {
+    unsigned int cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+// Entries of the loaded address space, through the recursive slots
+static pte_t* pte_ptr(unsigned int address) {
+    return (pte_t*)PTE_BASE + (address >> 12);
+}
+
+static pte_t* pde_ptr(unsigned int address) {
+    return (pte_t*)PDE_BASE + (address >> PDE_SHIFT);
+}
+
+// Zeroed frame: every entry not present, no OS bits
+static unsigned int alloc_table(void) {
+    return pmm_alloc_zeroed_page(PMM_PAGE_KERNEL | PMM_PAGE_TAG(MEM_TAG_PAGING));
+}
+
+// Page tables and directories always live in the direct map
+static pte_t* entry_table(pte_t entry) {
+    return (pte_t*)(unsigned int)(entry & PTE_FRAME);
+}
+
+// PDE for address in any directory, reached through the direct map
+static pte_t* dir_pde(unsigned int dir, unsigned int address) {
+#ifdef CONFIG_PAE
+    pte_t* pd = entry_table(((pte_t*)dir)[address >> 30]);
+    return pd + ((address >> PDE_SHIFT) & (PTES_PER_TABLE - 1));
+#else
+    return (pte_t*)dir + (address >> PDE_SHIFT);
+#endif
+}
+
+// PTE for address in any directory, reached through the direct map
+static pte_t* dir_pte(unsigned int dir, unsigned int address, int make) {
+    pte_t* pde = dir_pde(dir, address);
+    if (*pde & PDE_LARGE) return 0;  // covered by a large page, no PTE to hand out
+    if (!(*pde & PAGE_PRESENT)) {
+        if (!make) return 0;
+        unsigned int table = alloc_table();
+        if (!table) return 0;
+        *pde = table | PDE_TABLE_FLAGS;
+    }
+    return entry_table(*pde) + ((address >> 12) & (PTES_PER_TABLE - 1));
+}
+
+// An empty directory. With PAE that is the PDPT plus all four
+// directories, since PDPT entries are only read on CR3 loads.
+static unsigned int alloc_directory(void) {
+    unsigned int dir = alloc_table();
+    if (!dir) return 0;
+#ifdef CONFIG_PAE
+    for (int i = 0; i < 4; i++) {
+        unsigned int pd = alloc_table();
+        if (!pd) {
+            while (i--) pmm_free_page((unsigned int)entry_table(((pte_t*)dir)[i]));
+            pmm_free_page(dir);
+            return 0;
         }
-        tmp = (unsigned int)dir->tables[table_idx];
-        dir->tables_physical[table_idx] = tmp | 0x7;
-        return &dir->tables[table_idx]->pages[address % 1024];
+        ((pte_t*)dir)[i] = pd | PAGE_PRESENT;  // PDPTEs take no R/W or U/S bits
+    }
+#endif
+    return dir;
+}
+
+static void free_directory(unsigned int dir) {
+#ifdef CONFIG_PAE
+    for (int i = 0; i < 4; i++) pmm_free_page((unsigned int)entry_table(((pte_t*)dir)[i]));
+#endif
+    pmm_free_page(dir);
+}
+
+// Point the recursive slots of dir at its own directory pages
+static void set_recursive(unsigned int dir) {
+#ifdef CONFIG_PAE
+    for (unsigned int i = 0; i < 4; i++) {
+        *dir_pde(dir, (RECURSIVE_SLOT + i) << PDE_SHIFT) =
+            (((pte_t*)dir)[i] & PTE_FRAME) | PAGE_PRESENT | PAGE_WRITE;
+    }
+#else
+    *dir_pde(dir, RECURSIVE_SLOT << PDE_SHIFT) = dir | PAGE_PRESENT | PAGE_WRITE;
+#endif
+}
+
+// Kernel PDEs are copied into process directories when they are created;
+// page tables the kernel adds later (heap growth) are picked up here.
+static int sync_kernel_pde(unsigned int address) {
+    if (is_user_address(address) || (address >> PDE_SHIFT) >= RECURSIVE_SLOT) return 0;
+    pte_t* pde = pde_ptr(address);
+    pte_t kernel_pde = *dir_pde(kernel_directory, address);
+    if (!(kernel_pde & PAGE_PRESENT) || *pde == kernel_pde) return 0;
+    *pde = kernel_pde;
+    return 1;
+}
+
+// PTE for address in the loaded address space. With make, a missing page
+// table is created; kernel tables always go into the kernel directory so
+// every address space can pick them up.
+static pte_t* current_pte(unsigned int address, int make) {
+    if (!paging_enabled) return dir_pte(kernel_directory, address, make);
+
+    pte_t* pde = pde_ptr(address);
+    if (!(*pde & PAGE_PRESENT)) sync_kernel_pde(address);
+    if (!(*pde & PAGE_PRESENT)) {
+        if (!make) return 0;
+        unsigned int table = alloc_table();
+        if (!table) return 0;
+        pte_t entry = table | PDE_TABLE_FLAGS;
+        if (!is_user_address(address)) *dir_pde(kernel_directory, address) = entry;
+        *pde = entry;
+        asm volatile("invlpg (%0)" :: "r"(pte_ptr(address)) : "memory");
+    }
+    if (*pde & PDE_LARGE) return 0;
+    return pte_ptr(address);
+}
+
+// Flush the whole TLB; global entries only go when CR4.PGE is toggled
+static void flush_tlb_all(int include_global) {
+    if (include_global && kernel_global) {
+        unsigned int cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+        asm volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
     } else {
-        return 0;
+        asm volatile("mov %0, %%cr3" :: "r"(read_cr3()) : "memory");
     }
 }
 
-void alloc_frame(page_t* page, int is_kernel, int is_writeable) {
-    if (page->frame != 0) return;
-    unsigned int idx = pmm_alloc_page() / 0x1000;
-    page->present = 1;
-    page->rw = (is_writeable) ? 1 : 0;
-    page->user = (is_kernel) ? 0 : 1;
-    page->frame = idx;
+// Drop this CPU's stale translations for a batch of pages at address
+void paging_flush_tlb_local(unsigned int address, unsigned int pages) {
+    if (pages > FLUSH_ALL_PAGES) {
+        flush_tlb_all(!is_user_address(address));
+        return;
+    }
+    for (unsigned int i = 0; i < pages; i++) {
+        asm volatile("invlpg (%0)" :: "r"(address + i * PAGE_SIZE) : "memory");
+    }
 }
 
-void free_frame(page_t* page) {
-    unsigned int frame;
-    if (!(frame = page->frame)) return;
-    pmm_free_page(frame * 0x1000);
-    page->frame = 0;
+void paging_leave_directory(unsigned int directory) {
+    if (read_cr3() == directory) {
+        asm volatile("mov %0, %%cr3" :: "r"(kernel_directory) : "memory");
+    }
+}
+
+// Kernel mappings are shared by every CPU, so their flushes are too
+static void flush_tlb_range(unsigned int address, unsigned int pages) {
+    paging_flush_tlb_local(address, pages);
+    if (!is_user_address(address)) smp_tlb_shootdown(address, pages);
 }
 
-void switch_page_directory(page_directory_t* dir) {
-    current_directory = dir;
-    asm volatile("mov %0, %%cr3" :: "r"(&dir->tables_physical));
+// Kernel pointer to a user frame: direct-mapped frames are used as they
+// are, high memory goes through one of this CPU's KMAP_SLOTS windows,
+// valid until the slot is reused. Windows are private to their CPU, so
+// the local invlpg is enough; callers (the page fault handler) run with
+// interrupts off and cannot be moved mid-use.
+static void* kmap(unsigned int slot, phys_addr_t frame) {
+    if (frame < KERNEL_DIRECT_MAP_END) return (void*)(unsigned int)frame;
+    unsigned int address = KMAP_BASE + (this_cpu()->index * KMAP_SLOTS + slot) * PAGE_SIZE;
+    pte_t* pte = current_pte(address, 1);
+    if (!pte) return 0;
+    *pte = frame | PAGE_PRESENT | PAGE_WRITE;
+    asm volatile("invlpg (%0)" :: "r"(address) : "memory");
+    return (void*)address;
+}
+
+static void enable_paging(unsigned int dir) {
+#ifdef CONFIG_PAE
+    unsigned int cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PAE;
+    asm volatile("mov %0, %%cr4" :: "r"(cr4));
+#endif
+    asm volatile("mov %0, %%cr3" :: "r"(dir));
     unsigned int cr0;
     asm volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
+    cr0 |= 0x80000000 | CR0_WP;
     asm volatile("mov %0, %%cr0" :: "r"(cr0));
+    paging_enabled = 1;
+}
+
+static unsigned int cpu_features(void) {
+    unsigned int eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return edx;
+}
+
+#ifdef CONFIG_PAE
+static int cpu_has_pae(void) {
+    return (cpu_features() >> 6) & 1;
+}
+#else
+static int cpu_has_pse(void) {
+    return (cpu_features() >> 3) & 1;
+}
+#endif
+
+static int cpu_has_pge(void) {
+    return (cpu_features() >> 13) & 1;
 }
 
 void paging_init() {
     print_string("[OK] Initializing Paging...\n");
-    kernel_directory = (page_directory_t*)pmm_alloc_page();
-    for (int i = 0; i < 1024; i++) {
-        kernel_directory->tables_physical[i] = 0;
-        kernel_directory->tables[i] = 0;
-    }
-    unsigned int i = 0;
-    while (i < 0x00400000) {
-        alloc_frame(get_page(i, 1, kernel_directory), 0, 0);
-        i += 0x1000;
-    }
-    print_string("  Identity mapped: 0x00000000 - 0x00400000 (4MB)\n");
-    unsigned int heap_start = 0x00400000;
-    unsigned int heap_pages = 256;
-    for (i = 0; i < heap_pages; i++) {
-        alloc_frame(get_page(heap_start + i * 0x1000, 1, kernel_directory), 0, 1);
-    }
-    print_string("  Heap mapped: 0x00400000 - 0x00500000 (1MB)\n");
-    switch_page_directory(kernel_directory);
+#ifdef CONFIG_PAE
+    if (!cpu_has_pae()) {
+        print_string("[ERROR] Kernel built with PAE but the CPU lacks it\n");
+        print_string("System halted.\n");
+        for(;;);
+    }
+#endif
+    kernel_directory = alloc_directory();
+    set_recursive(kernel_directory);
+
+    // Kernel mappings are identical in every address space, so with PGE
+    // they are marked global and stay in the TLB across CR3 reloads
+    kernel_global = cpu_has_pge();
+    unsigned int global = kernel_global ? PAGE_GLOBAL : 0;
+
+    // The first 4MB keeps 4KB granularity because protections differ:
+    // page 0 stays unmapped to catch null pointers, kernel text/rodata is
+    // user-readable but read-only, everything else is kernel read/write.
+    unsigned int ro_end = (unsigned int)&kernel_ro_end & ~0xFFF;
+    map_range(0x1000, 0x1000, ro_end - 0x1000, PAGE_USER | global);
+    map_range(ro_end, ro_end, LOW_MAP_END - ro_end, PAGE_WRITE | global);
+    print_string("  Low 4MB: 4KB pages (null guard, RO kernel text)\n");
+
+    // Direct-map the rest of low memory 1:1 so every kernel frame is
+    // addressable. Large pages need CR4.PSE, which PAE implies.
+    unsigned int ram_end = pmm_get_memory_end();
+    if (ram_end > KERNEL_DIRECT_MAP_END) ram_end = KERNEL_DIRECT_MAP_END;
+    unsigned int large = 0;
+#ifdef CONFIG_PAE
+    int use_large = 1;
+#else
+    int use_large = cpu_has_pse();
+    if (use_large) {
+        unsigned int cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_PSE;
+        asm volatile("mov %0, %%cr4" :: "r"(cr4));
+    }
+#endif
+    if (use_large) {
+        for (unsigned int addr = LOW_MAP_END; addr < ram_end; addr += LARGE_PAGE_SIZE) {
+            *dir_pde(kernel_directory, addr) =
+                addr | PDE_LARGE | PAGE_WRITE | PAGE_PRESENT | global;
+            large++;
+        }
+    } else if (ram_end > LOW_MAP_END) {
+        // No PSE: fall back to 4KB page tables for the direct map
+        map_range(LOW_MAP_END, LOW_MAP_END, ram_end - LOW_MAP_END, PAGE_WRITE | global);
+    }
+
+    print_string("  Direct map: 0x00000000 - ");
+    print_hex(ram_end < LOW_MAP_END ? LOW_MAP_END : ram_end);
+    if (large) {
+        print_string(" (");
+        print_dec(large);
+        print_string(LARGE_PAGE_SIZE == 0x200000 ? " x 2MB pages)\n" : " x 4MB pages)\n");
+    } else {
+        print_string(" (4KB pages, no PSE)\n");
+    }
+
+    enable_paging(kernel_directory);
+#ifdef CONFIG_PAE
+    print_string("  PAE: 64-bit entries, physical memory above 4GB\n");
+#endif
+    if (kernel_global) {
+        unsigned int cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_PGE;
+        asm volatile("mov %0, %%cr4" :: "r"(cr4));
+        print_string("  Kernel pages global (PGE)\n");
+    }
+    print_string("  Recursive map: PTEs at ");
+    print_hex(PTE_BASE);
+    print_string("\n");
     print_string("[OK] Paging enabled\n");
 }
 
+// Back a page of a reserved area with a freshly zeroed frame
+static int demand_zero_fill(process_t* proc, unsigned int address, unsigned int error_code) {
+    vm_area_t* vma = vma_find(proc->vm_areas, address);
+    if (!vma) return 0;
+    if ((error_code & PF_WRITE) && !(vma->flags & VMA_WRITE)) return 0;
+    if ((error_code & PF_USER) && !(vma->flags & VMA_USER)) return 0;
+
+    // A pre-zeroed frame if the idle process left one; otherwise a user
+    // frame (high memory first) cleared here
+    pte_t* pte = current_pte(address, 1);
+    if (!pte) return 0;
+    phys_addr_t frame = pmm_alloc_prezeroed_page(PMM_PAGE_USER | PMM_PAGE_TAG(MEM_TAG_PROCESS));
+    if (!frame) {
+        frame = pmm_alloc_user_page();
+        if (!frame) return 0;
+        unsigned int* p = (unsigned int*)kmap(0, frame);
+        if (!p) {
+            pmm_put_page(frame);
+            return 0;
+        }
+        for (int i = 0; i < 1024; i++) p[i] = 0;
+    }
+
+    *pte = frame | PAGE_PRESENT |
+           ((vma->flags & VMA_WRITE) ? PAGE_WRITE : 0) |
+           ((vma->flags & VMA_USER) ? PAGE_USER : 0);
+    proc->minor_faults++;
+    return 1;
+}
+
+// Resolve a write to a copy-on-write page: the last sharer simply gets
+// write access back, anyone else takes a private copy of the frame
+static int cow_fault(unsigned int address) {
+    pte_t* pte = current_pte(address, 0);
+    if (!pte || (*pte & (PAGE_PRESENT | PAGE_COW)) != (PAGE_PRESENT | PAGE_COW)) return 0;
+
+    phys_addr_t old_frame = *pte & PTE_FRAME;
+    phys_addr_t frame = old_frame;
+    if (pmm_page_shares(old_frame)) {
+        frame = pmm_alloc_user_page();
+        if (!frame) return 0;
+        unsigned int* src = (unsigned int*)kmap(0, old_frame);
+        unsigned int* dst = (unsigned int*)kmap(1, frame);
+        if (!src || !dst) {
+            pmm_put_page(frame);
+            return 0;
+        }
+        for (int i = 0; i < 1024; i++) dst[i] = src[i];
+        pmm_put_page(old_frame);
+    }
+    *pte = frame | (*pte & PAGE_FLAGS & ~PAGE_COW) | PAGE_WRITE;
+    asm volatile("invlpg (%0)" :: "r"(address & PAGE_FRAME) : "memory");
+    return 1;
+}
+
 void page_fault(unsigned int error_code, unsigned int faulting_address) {
+    process_t* proc = process_get_current();
+
+    // Kernel threads run on whichever address space they borrowed, so go
+    // by what is loaded rather than by the process
+    if (!proc || proc->page_directory != read_cr3()) proc = 0;  // no VMAs to consult
+
+    if (!(error_code & PF_PRESENT)) {
+        if (sync_kernel_pde(faulting_address)) return;
+        if (proc && demand_zero_fill(proc, faulting_address, error_code)) return;
+    } else if (error_code & PF_WRITE) {
+        if (cow_fault(faulting_address)) return;
+    }
+
     int present = !(error_code & 0x1);
     int rw = error_code & 0x2;
     int user = error_code & 0x4;
@@ -119,22 +446,189 @@ void page_fault(unsigned int error_code, unsigned int faulting_address) {
     for(;;);
 }
 
-page_directory_t* get_current_directory() {
-    return current_directory;
+// Create an address space: kernel mappings shared, user range empty.
+// Returns the physical address of the new directory, or 0.
+unsigned int paging_create_directory() {
+    unsigned int dir = alloc_directory();
+    if (!dir) return 0;
+    for (unsigned int i = 0; i < RECURSIVE_SLOT; i++) {
+        if (i < USER_PDE_FIRST || i >= USER_PDE_LAST) {
+            *dir_pde(dir, i << PDE_SHIFT) = *dir_pde(kernel_directory, i << PDE_SHIFT);
+        }
+    }
+    set_recursive(dir);
+    return dir;
+}
+
+// Duplicate an address space for fork. User frames are not copied:
+// writable pages become read-only + COW in both directories and share
+// the frame, so the cost scales with the page tables, not resident memory.
+// Returns the physical address of the new directory, or 0.
+unsigned int paging_clone_directory(unsigned int directory) {
+    unsigned int clone = paging_create_directory();
+    if (!clone) return 0;
+
+    for (unsigned int i = USER_PDE_FIRST; i < USER_PDE_LAST; i++) {
+        pte_t pde = *dir_pde(directory, i << PDE_SHIFT);
+        if (!(pde & PAGE_PRESENT)) continue;
+        pte_t* table = entry_table(pde);
+        unsigned int copy = alloc_table();
+        if (!copy) {
+            paging_destroy_directory(clone);
+            return 0;
+        }
+        pte_t* entries = (pte_t*)copy;
+        for (int j = 0; j < PTES_PER_TABLE; j++) {
+            pte_t pte = table[j];
+            if (pte & PAGE_PRESENT) {
+                if (pte & PAGE_WRITE) {
+                    pte = (pte & ~(pte_t)PAGE_WRITE) | PAGE_COW;
+                    table[j] = pte;
+                }
+                pmm_share_page(pte & PTE_FRAME);
+            }
+            entries[j] = pte;
+        }
+        *dir_pde(clone, i << PDE_SHIFT) = copy | (pde & PAGE_FLAGS);
+    }
+
+    // The source lost write access to its pages; drop stale TLB entries
+    if (read_cr3() == directory) flush_tlb_all(0);
+    return clone;
+}
+
+// Free an address space and every frame mapped in its user range
+void paging_destroy_directory(unsigned int directory) {
+    if (!directory || directory == kernel_directory) return;
+
+    // Kernel threads here or on other CPUs may still be borrowing it;
+    // move them all to the kernel's before its tables go
+    paging_leave_directory(directory);
+    smp_leave_directory(directory);
+
+    for (unsigned int i = USER_PDE_FIRST; i < USER_PDE_LAST; i++) {
+        pte_t pde = *dir_pde(directory, i << PDE_SHIFT);
+        if (!(pde & PAGE_PRESENT)) continue;
+        pte_t* table = entry_table(pde);
+        for (int j = 0; j < PTES_PER_TABLE; j++) {
+            if (table[j] & PAGE_PRESENT) pmm_put_page(table[j] & PTE_FRAME);
+        }
+        pmm_free_page((unsigned int)table);
+    }
+    free_directory(directory);
+}
+
+unsigned int paging_get_kernel_directory() {
+    return kernel_directory;
+}
+
+// Map [virtual_addr, virtual_addr + size) to consecutive frames from
+// physical_addr in the loaded address space. Only entries that replace a
+// live mapping need invalidating, and that happens once for the batch.
+int map_range(unsigned int virtual_addr, phys_addr_t physical_addr,
+              unsigned int size, unsigned int flags) {
+    unsigned int pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned int stale = 0;
+    virtual_addr &= PAGE_FRAME;
+    physical_addr &= ~(phys_addr_t)PAGE_FLAGS;
+    flags = (flags & PAGE_FLAGS) | PAGE_PRESENT;
+
+    for (unsigned int i = 0; i < pages; i++) {
+        pte_t* pte = current_pte(virtual_addr + i * PAGE_SIZE, 1);
+        if (!pte) {
+            unmap_range(virtual_addr, i * PAGE_SIZE);
+            return 0;
+        }
+        if (*pte & PAGE_PRESENT) stale++;
+        *pte = (physical_addr + (phys_addr_t)i * PAGE_SIZE) | flags;
+    }
+    if (stale && paging_enabled) flush_tlb_range(virtual_addr, pages);
+    return 1;
+}
+
+// Remove the mappings in [virtual_addr, virtual_addr + size) with a single
+// TLB flush. Frames are left to the caller.
+void unmap_range(unsigned int virtual_addr, unsigned int size) {
+    unsigned int pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned int stale = 0;
+    virtual_addr &= PAGE_FRAME;
+
+    for (unsigned int i = 0; i < pages; i++) {
+        unsigned int address = virtual_addr + i * PAGE_SIZE;
+        pte_t* pte = current_pte(address, 0);
+        if (!pte) {
+            // No page table here: skip to the next table boundary
+            i += (PTES_PER_TABLE - 1) - ((address >> 12) & (PTES_PER_TABLE - 1));
+            continue;
+        }
+        if (!(*pte & PAGE_PRESENT)) continue;
+        *pte = 0;
+        stale++;
+    }
+    if (stale && paging_enabled) flush_tlb_range(virtual_addr, pages);
+}
+
+// As unmap_range, and give the frames back to the PMM, but only once no
+// CPU can still reach them through its TLB. The PTEs keep their frame
+// (not present) until the flush is done.
+void unmap_range_free(unsigned int virtual_addr, unsigned int size) {
+    unsigned int pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned int stale = 0;
+    virtual_addr &= PAGE_FRAME;
+
+    for (unsigned int i = 0; i < pages; i++) {
+        unsigned int address = virtual_addr + i * PAGE_SIZE;
+        pte_t* pte = current_pte(address, 0);
+        if (!pte) {
+            i += (PTES_PER_TABLE - 1) - ((address >> 12) & (PTES_PER_TABLE - 1));
+            continue;
+        }
+        if (!(*pte & PAGE_PRESENT)) continue;
+        *pte &= ~(pte_t)PAGE_PRESENT;
+        stale++;
+    }
+    if (!stale) return;
+    if (paging_enabled) flush_tlb_range(virtual_addr, pages);
+
+    for (unsigned int i = 0; i < pages; i++) {
+        unsigned int address = virtual_addr + i * PAGE_SIZE;
+        pte_t* pte = current_pte(address, 0);
+        if (!pte) {
+            i += (PTES_PER_TABLE - 1) - ((address >> 12) & (PTES_PER_TABLE - 1));
+            continue;
+        }
+        if (*pte & PTE_FRAME) pmm_free_page((unsigned int)(*pte & PTE_FRAME));
+        *pte = 0;
+    }
 }
 
 void map_page(unsigned int virtual_addr, unsigned int physical_addr, int is_kernel, int is_writeable) {
-    page_t* page = get_page(virtual_addr, 1, current_directory);
-    page->present = 1;
-    page->rw = (is_writeable) ? 1 : 0;
-    page->user = (is_kernel) ? 0 : 1;
-    page->frame = physical_addr / 0x1000;
+    unsigned int flags = is_writeable ? PAGE_WRITE : 0;
+    if (!is_kernel) flags |= PAGE_USER;
+    else if (kernel_global) flags |= PAGE_GLOBAL;
+    map_range(virtual_addr, physical_addr, PAGE_SIZE, flags);
 }
 
 void unmap_page(unsigned int virtual_addr) {
-    page_t* page = get_page(virtual_addr, 0, current_directory);
-    if (page) {
-        page->present = 0;
-        asm volatile("invlpg (%0)" :: "r"(virtual_addr) : "memory");
+    unmap_range(virtual_addr, PAGE_SIZE);
+}
+
+// Kernel addresses only; those are always backed by the direct map
+unsigned int virt_to_phys(unsigned int virtual_addr) {
+    pte_t pde = paging_enabled ? *pde_ptr(virtual_addr) : *dir_pde(kernel_directory, virtual_addr);
+    if ((pde & (PAGE_PRESENT | PDE_LARGE)) == (PAGE_PRESENT | PDE_LARGE)) {
+        return (unsigned int)(pde & PTE_FRAME & ~(pte_t)(LARGE_PAGE_SIZE - 1)) +
+               (virtual_addr & (LARGE_PAGE_SIZE - 1));
     }
+    pte_t* pte = current_pte(virtual_addr, 0);
+    if (!pte || !(*pte & PAGE_PRESENT)) return 0;
+    return (unsigned int)(*pte & PTE_FRAME) + (virtual_addr & ~PAGE_FRAME);
+}
+
+// User space is only ever mapped with 4KB pages
+int paging_user_phys(unsigned int virtual_addr, phys_addr_t* phys) {
+    pte_t* pte = current_pte(virtual_addr, 0);
+    if (!pte || !(*pte & PAGE_PRESENT)) return 0;
+    *phys = (phys_addr_t)(*pte & PTE_FRAME) + (virtual_addr & ~PAGE_FRAME);
+    return 1;
 }
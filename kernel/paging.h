@@ -4,9 +4,63 @@
 #ifndef PAGING_H
 #define PAGING_H
 
+#include "pmm.h"
+
+// RAM below this address is direct-mapped 1:1 into the kernel address space
+#define KERNEL_DIRECT_MAP_END  0x40000000
+
+// User address space layout
+#define USER_SPACE_START       0x40000000
+#define USER_SPACE_END         0xC0000000
+#define USER_HEAP_START        0x50000000
+#define USER_HEAP_SIZE         0x01000000   // 16MB reserved, backed on demand
+#define USER_STACK_TOP         0xBFFFF000
+#define USER_STACK_SIZE        0x00100000   // 1MB reserved, backed on demand
+
+#define PAGE_SIZE              0x1000
+
+// Page table entry bits
+#define PAGE_PRESENT           0x001
+#define PAGE_WRITE             0x002
+#define PAGE_USER              0x004
+#define PAGE_PWT               0x008    // write-through
+#define PAGE_PCD               0x010    // cache disabled (device memory)
+#define PAGE_ACCESSED          0x020
+#define PAGE_DIRTY             0x040
+#define PAGE_GLOBAL            0x100    // survives CR3 reloads (needs CR4.PGE)
+#define PAGE_COW               0x200    // OS bit: shared until written
+#define PAGE_FLAGS             0x00000FFF
+#define PAGE_FRAME             0xFFFFF000
+
 void paging_init();
 void page_fault(unsigned int error_code, unsigned int faulting_address);
 void map_page(unsigned int virtual_addr, unsigned int physical_addr, int is_kernel, int is_writeable);
 void unmap_page(unsigned int virtual_addr);
+unsigned int virt_to_phys(unsigned int virtual_addr);
+
+// Physical address behind a user address in the loaded address space,
+// which may lie above 4GB. Returns 0 if the page is not present.
+int paging_user_phys(unsigned int virtual_addr, phys_addr_t* phys);
+
+// Batched mapping in the loaded address space: one TLB flush per call.
+// flags are PAGE_* bits (PAGE_PRESENT is implied). map_range returns 0
+// and maps nothing if a page table cannot be allocated.
+int map_range(unsigned int virtual_addr, phys_addr_t physical_addr,
+              unsigned int size, unsigned int flags);
+void unmap_range(unsigned int virtual_addr, unsigned int size);
+void unmap_range_free(unsigned int virtual_addr, unsigned int size);
+
+// Flush only the calling CPU's TLB (shootdown IPIs end up here)
+void paging_flush_tlb_local(unsigned int address, unsigned int pages);
+
+// Switch the calling CPU to the kernel's directory if it has directory
+// loaded (kernel threads borrow whatever address space they find)
+void paging_leave_directory(unsigned int directory);
+
+// Per-process address spaces (physical address of the directory)
+unsigned int paging_create_directory();
+unsigned int paging_clone_directory(unsigned int directory);
+void paging_destroy_directory(unsigned int directory);
+unsigned int paging_get_kernel_directory();
 
 #endif
@@ -1,208 +1,875 @@
 // SUB OS - Physical Memory Manager
 // Copyright (c) 2025 SUB OS Project
+//
+// Free memory is kept in a binary buddy allocator (orders 0..PMM_MAX_ORDER).
+// The page bitmap stays the authoritative used/free record for statistics
+// and for pmm_set_page_used/free; the buddy free lists are kept in sync.
+//
+// Single pages are found through a two-level bitmap: one summary bit per
+// bitmap word marks words that are completely used, and a cursor points at
+// the lowest word that may still hold a free page. A lookup is a couple of
+// 32-bit word scans no matter how full memory is.
+//
+// Frames are split into zones at the end of the kernel direct map. The low
+// zone serves the kernel, which needs frames it can address directly; the
+// high zone (PAE builds only) holds RAM above that, up to 64GB, and is
+// handed out for user pages. Each zone has its own cursor and free lists.
+//
+// Every frame has a 12-byte descriptor in the frame database. Free frames
+// use its links for the buddy lists; allocated frames carry a reference
+// count and type flags, and user frames sit on an LRU list through the
+// same links.
+//
+// The idle process keeps a small pool of pre-zeroed low-memory frames
+// topped up (pmm_prezero_pages), so pmm_alloc_zeroed_page usually costs
+// no more than a plain allocation.
+//
+// pmm_lock guards the bitmaps, zones, frame database and pool. It is
+// held with interrupts off and never while a frame is being zeroed.
 
 #include "pmm.h"
 #include "kernel.h"
 #include "memory.h"
+#include "paging.h"
+#include "spinlock.h"
 
-// Page size (4KB)
-#define PAGE_SIZE 4096
-#define PAGES_PER_BYTE 8
+#define PAGES_PER_WORD 32
+
+// Highest physical address the PMM will manage
+#ifdef CONFIG_PAE
+#define PMM_PHYS_LIMIT   0x1000000000ULL   // 64GB, the PAE maximum
+#else
+#define PMM_PHYS_LIMIT   KERNEL_DIRECT_MAP_END
+#endif
+
+#define ZONE_LOW   0
+#define ZONE_HIGH  1
+#define ZONE_COUNT 2
+
+// End-of-list marker for the buddy free lists
+#define BUDDY_NIL        0xFFFFFFFF
+// Order value for pages that are not the head of a free block
+#define BUDDY_ORDER_NONE 0xFF
+
+// Frame descriptor. Links are page indices, so the lists work without the
+// pages themselves being mapped: buddy free lists while the frame is free,
+// the user LRU list while it is allocated. refs is 0 for a free frame.
+typedef struct {
+    unsigned int next;
+    unsigned int prev;
+    unsigned char order;
+    unsigned char flags;     // PMM_PAGE_* and the PMM_PAGE_TAG bits
+    unsigned short refs;
+} page_frame_t;
+
+#define PMM_FLAG_COUNT 5
+
+// Pre-zeroed frames kept ready for pmm_alloc_zeroed_page
+#define PMM_ZERO_POOL  64
 
 // Bitmap for tracking page allocation
-// Each bit represents one 4KB page
-static unsigned char* page_bitmap = (unsigned char*)0x10000; // Bitmap at 1MB
-static unsigned int total_pages = 0;
-static unsigned int used_pages = 0;
-static unsigned int bitmap_size = 0;
+// Each bit represents one 4KB page, set = used
+static unsigned int* page_bitmap = 0;
+static unsigned int* summary_bitmap = 0;  // bit set = bitmap word is full
+static unsigned int total_pages = 0;      // frame span, holes included
+static unsigned int used_pages = 0;       // holes count as used
+static unsigned int hole_pages = 0;       // frames that are not usable RAM
+static unsigned int bitmap_words = 0;
+static unsigned int summary_words = 0;
+
+typedef struct {
+    unsigned int first_word;       // bitmap words [first_word, end_word)
+    unsigned int end_word;
+    unsigned int next_free_word;   // lowest word that may hold a free page
+    unsigned int free_lists[PMM_MAX_ORDER + 1];
+    unsigned int free_counts[PMM_MAX_ORDER + 1];
+} pmm_zone_t;
+
+static pmm_zone_t zones[ZONE_COUNT];
+static unsigned int low_pages = 0;        // first frame of the high zone
+static unsigned int high_pages = 0;       // usable frames in the high zone
+
+// Single-page allocation scan statistics
+static unsigned int scan_allocs = 0;
+static unsigned int scan_words = 0;
+
+// Buddy allocator state
+static page_frame_t* frames = 0;
+
+// Pages carrying each PMM_PAGE_* flag, indexed by bit number
+static unsigned int flag_pages[PMM_FLAG_COUNT];
+
+// Allocated pages per MEM_TAG_* owner, and the most ever held at once
+static unsigned int tag_pages[MEM_TAG_COUNT];
+static unsigned int tag_peak[MEM_TAG_COUNT];
+
+// Allocated user frames, least recently used at the head
+static unsigned int lru_head = BUDDY_NIL;
+static unsigned int lru_tail = BUDDY_NIL;
+static unsigned int lru_pages = 0;
+
+// Pre-zeroed pool: allocated in the bitmap, but no refs or flags yet
+static unsigned int zero_pool[PMM_ZERO_POOL];
+static unsigned int zero_pool_count = 0;
+static unsigned int zero_pool_hits = 0;
+static unsigned int zero_pool_misses = 0;
+
+static spinlock_t pmm_lock;
 
 // Kernel end marker (defined in linker script)
 extern unsigned int kernel_end;
 
+static pmm_zone_t* zone_of(unsigned int page) {
+    return &zones[page >= low_pages ? ZONE_HIGH : ZONE_LOW];
+}
+
+// ── Bitmap helpers ──────────────────────────────────────────────────────────
+
+static int bitmap_test(unsigned int page) {
+    return page_bitmap[page / PAGES_PER_WORD] & (1u << (page % PAGES_PER_WORD));
+}
+
+static void bitmap_set_range(unsigned int page, unsigned int count) {
+    for (unsigned int i = page; i < page + count; i++) {
+        unsigned int word = i / PAGES_PER_WORD;
+        unsigned int bit = 1u << (i % PAGES_PER_WORD);
+        if (page_bitmap[word] & bit) continue;
+        page_bitmap[word] |= bit;
+        used_pages++;
+        if (page_bitmap[word] == 0xFFFFFFFF) {
+            summary_bitmap[word / 32] |= 1u << (word % 32);
+        }
+    }
+}
+
+static void bitmap_clear_range(unsigned int page, unsigned int count) {
+    for (unsigned int i = page; i < page + count; i++) {
+        unsigned int word = i / PAGES_PER_WORD;
+        unsigned int bit = 1u << (i % PAGES_PER_WORD);
+        if (!(page_bitmap[word] & bit)) continue;
+        page_bitmap[word] &= ~bit;
+        used_pages--;
+        summary_bitmap[word / 32] &= ~(1u << (word % 32));
+        pmm_zone_t* zone = zone_of(i);
+        if (word < zone->next_free_word) zone->next_free_word = word;
+    }
+}
+
+// Find the lowest free page of the zone at or above its cursor, or
+// BUDDY_NIL. Every word of the zone below next_free_word is known to be
+// full. Zones start on a summary word boundary.
+static unsigned int bitmap_find_free(pmm_zone_t* zone) {
+    unsigned int s = zone->next_free_word / 32;
+    unsigned int s_end = (zone->end_word + 31) / 32;
+    // Ignore words below the cursor in the first summary word
+    unsigned int mask = ~0u << (zone->next_free_word % 32);
+
+    for (; s < s_end; s++, mask = ~0u) {
+        scan_words++;
+        unsigned int not_full = ~summary_bitmap[s] & mask;
+        if (!not_full) continue;
+
+        unsigned int word = s * 32 + __builtin_ctz(not_full);
+        scan_words++;
+        zone->next_free_word = word;
+        return word * PAGES_PER_WORD + __builtin_ctz(~page_bitmap[word]);
+    }
+
+    zone->next_free_word = zone->end_word;
+    return BUDDY_NIL;
+}
+
+// ── Frame database ──────────────────────────────────────────────────────────
+
+static void lru_unlink(unsigned int page) {
+    unsigned int next = frames[page].next;
+    unsigned int prev = frames[page].prev;
+    if (prev != BUDDY_NIL) frames[prev].next = next; else lru_head = next;
+    if (next != BUDDY_NIL) frames[next].prev = prev; else lru_tail = prev;
+    lru_pages--;
+}
+
+static void lru_append(unsigned int page) {
+    frames[page].next = BUDDY_NIL;
+    frames[page].prev = lru_tail;
+    if (lru_tail != BUDDY_NIL) frames[lru_tail].next = page; else lru_head = page;
+    lru_tail = page;
+    lru_pages++;
+}
+
+// Change a frame's flags, keeping the per-flag counters and the LRU list
+// (which holds exactly the allocated user frames) in step
+static void frame_set_flags(unsigned int page, unsigned int flags) {
+    unsigned int old = frames[page].flags;
+    unsigned int changed = old ^ flags;
+    if (!changed) return;
+    for (unsigned int bit = 0; bit < PMM_FLAG_COUNT; bit++) {
+        if (!(changed & (1u << bit))) continue;
+        if (flags & (1u << bit)) flag_pages[bit]++; else flag_pages[bit]--;
+    }
+    if (changed & PMM_PAGE_USER) {
+        if (flags & PMM_PAGE_USER) lru_append(page); else lru_unlink(page);
+    }
+    frames[page].flags = (unsigned char)flags;
+}
+
+// A frame just taken off the free lists
+static void frame_claim(unsigned int page, unsigned int flags) {
+    unsigned int tag = PMM_PAGE_TAG_OF(flags);
+    frames[page].refs = 1;
+    frame_set_flags(page, flags);
+    if (++tag_pages[tag] > tag_peak[tag]) tag_peak[tag] = tag_pages[tag];
+}
+
+// A frame about to go back to the free lists
+static void frame_release(unsigned int page) {
+    if (frames[page].refs) tag_pages[PMM_PAGE_TAG_OF(frames[page].flags)]--;
+    frame_set_flags(page, 0);
+    frames[page].refs = 0;
+}
+
+// ── Buddy free lists ────────────────────────────────────────────────────────
+
+static void buddy_list_push(unsigned int page, unsigned int order) {
+    pmm_zone_t* zone = zone_of(page);
+    frames[page].order = (unsigned char)order;
+    frames[page].prev = BUDDY_NIL;
+    frames[page].next = zone->free_lists[order];
+    if (zone->free_lists[order] != BUDDY_NIL) {
+        frames[zone->free_lists[order]].prev = page;
+    }
+    zone->free_lists[order] = page;
+    zone->free_counts[order]++;
+}
+
+static void buddy_list_remove(unsigned int page, unsigned int order) {
+    unsigned int next = frames[page].next;
+    unsigned int prev = frames[page].prev;
+    pmm_zone_t* zone = zone_of(page);
+    if (prev != BUDDY_NIL) {
+        frames[prev].next = next;
+    } else {
+        zone->free_lists[order] = next;
+    }
+    if (next != BUDDY_NIL) {
+        frames[next].prev = prev;
+    }
+    frames[page].order = BUDDY_ORDER_NONE;
+    zone->free_counts[order]--;
+}
+
+// Smallest order whose block covers count pages
+static unsigned int buddy_order_for(unsigned int count) {
+    unsigned int order = 0;
+    while ((1u << order) < count) order++;
+    return order;
+}
+
+// Return a block to the free lists, merging with its buddy while possible.
+// The zone boundary is 4MB aligned, so buddies never straddle it.
+static void buddy_free_block(unsigned int page, unsigned int order) {
+    while (order < PMM_MAX_ORDER) {
+        unsigned int buddy = page ^ (1u << order);
+        if (buddy + (1u << order) > total_pages) break;
+        if (frames[buddy].order != order) break;
+        buddy_list_remove(buddy, order);
+        page &= ~(1u << order);
+        order++;
+    }
+    buddy_list_push(page, order);
+}
+
+// Take a block of exactly 2^order pages, splitting a larger one if needed
+static unsigned int buddy_alloc_block(pmm_zone_t* zone, unsigned int order) {
+    unsigned int o = order;
+    while (o <= PMM_MAX_ORDER && zone->free_lists[o] == BUDDY_NIL) o++;
+    if (o > PMM_MAX_ORDER) return BUDDY_NIL;
+
+    unsigned int page = zone->free_lists[o];
+    buddy_list_remove(page, o);
+    while (o > order) {
+        o--;
+        buddy_list_push(page + (1u << o), o);
+    }
+    return page;
+}
+
+// Release an arbitrary page range as the largest aligned blocks that fit
+static void buddy_free_range(unsigned int page, unsigned int count) {
+    unsigned int end = page + count;
+    while (page < end) {
+        unsigned int order = 0;
+        while (order < PMM_MAX_ORDER &&
+               !(page & (1u << order)) &&
+               page + (2u << order) <= end) {
+            order++;
+        }
+        buddy_free_block(page, order);
+        page += 1u << order;
+    }
+}
+
+// Remove one page from whichever free block contains it, splitting the
+// remainder back onto the lists. Returns 0 if the page was not free.
+static int buddy_carve_page(unsigned int page) {
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        unsigned int head = page & ~((1u << order) - 1);
+        if (frames[head].order != order) continue;
+
+        buddy_list_remove(head, order);
+        while (order > 0) {
+            order--;
+            unsigned int half = 1u << order;
+            if (page >= head + half) {
+                buddy_list_push(head, order);
+                head += half;
+            } else {
+                buddy_list_push(head + half, order);
+            }
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Page range [first, last) of a usable region below limit.
+// Returns 0 if nothing of it is left.
+static int region_pages(const memory_region_t* region, unsigned long long limit,
+                        unsigned int* first, unsigned int* last) {
+    unsigned long long end = region->end;
+    if (region->base >= limit) return 0;
+    if (end > limit) end = limit;
+    *first = (unsigned int)(region->base / PAGE_SIZE);
+    *last = (unsigned int)(end / PAGE_SIZE);
+    return *first < *last;
+}
+
+// Free the part of [first, last) that lies inside [lo, hi)
+static void release_clipped(unsigned int first, unsigned int last,
+                            unsigned int lo, unsigned int hi) {
+    if (first < lo) first = lo;
+    if (last > hi) last = hi;
+    if (first >= last) return;
+    bitmap_clear_range(first, last - first);
+    buddy_free_range(first, last - first);
+}
+
 // Initialize physical memory manager
 void pmm_init() {
     print_string("[OK] Initializing Physical Memory Manager...\n");
-    
-    // Get usable memory from memory detection
-    unsigned long usable_mem = get_usable_memory();
-    
-    if (usable_mem == 0) {
+    spin_lock_init(&pmm_lock, "pmm");
+
+    const memory_region_t* regions;
+    unsigned int region_count = memory_get_regions(&regions);
+
+    // Frame numbers span up to the end of the highest usable region;
+    // holes in between are tracked but never become free
+    unsigned int managed_pages = 0;
+    unsigned int clipped = 0;
+    total_pages = 0;
+    low_pages = KERNEL_DIRECT_MAP_END / PAGE_SIZE;
+    high_pages = 0;
+    for (unsigned int i = 0; i < region_count; i++) {
+        unsigned int first, last;
+        if (regions[i].end > PMM_PHYS_LIMIT) clipped = 1;
+        if (!region_pages(&regions[i], PMM_PHYS_LIMIT, &first, &last)) continue;
+        if (last > total_pages) total_pages = last;
+        managed_pages += last - first;
+        if (last > low_pages) high_pages += last - (first > low_pages ? first : low_pages);
+    }
+
+    if (managed_pages == 0) {
         print_string("[ERROR] No usable memory detected!\n");
         return;
     }
-    
-    // Calculate total number of pages
-    total_pages = usable_mem / PAGE_SIZE;
-    bitmap_size = total_pages / PAGES_PER_BYTE;
-    if (total_pages % PAGES_PER_BYTE) bitmap_size++;
-    
-    print_string("  Total pages: ");
-    print_dec(total_pages);
-    print_string(" (");
-    print_dec(total_pages * 4);
-    print_string(" KB)\n");
-    
-    print_string("  Bitmap size: ");
-    print_dec(bitmap_size);
-    print_string(" bytes\n");
-    
-    // Initialize bitmap - mark all as used
-    for (unsigned int i = 0; i < bitmap_size; i++) {
-        page_bitmap[i] = 0xFF;
-    }
-    
-    // Mark first 1MB as used (BIOS, video memory, etc.)
-    unsigned int first_mb_pages = (1024 * 1024) / PAGE_SIZE;
-    
-    // Mark usable memory as free (starting from 1MB)
-    for (unsigned int i = first_mb_pages; i < total_pages; i++) {
-        pmm_free_page(i * PAGE_SIZE);
-    }
-    
-    // Mark kernel memory as used
-    unsigned int kernel_pages = ((unsigned int)&kernel_end) / PAGE_SIZE + 1;
-    for (unsigned int i = 0; i < kernel_pages; i++) {
-        pmm_set_page_used(i * PAGE_SIZE);
-    }
-    
-    print_string("  Reserved: First ");
-    print_dec(kernel_pages);
-    print_string(" pages for kernel\n");
-    
+
+    if (clipped) {
+        print_string("  [WARN] Limiting PMM to the first ");
+        print_dec((unsigned int)(PMM_PHYS_LIMIT >> 20));
+        print_string(" MB of RAM\n");
+    }
+
+    hole_pages = total_pages - managed_pages;
+    bitmap_words = (total_pages + PAGES_PER_WORD - 1) / PAGES_PER_WORD;
+    summary_words = (bitmap_words + 31) / 32;
+    if (low_pages > total_pages) low_pages = total_pages;
+
+    // Metadata (bitmap, summary, buddy descriptors) is sized from the frame
+    // span and goes in the first direct-mapped RAM above the kernel image
+    // and the first 1MB (BIOS, video memory, etc.) that can hold it
+    unsigned int bitmap_bytes = (bitmap_words + summary_words) * 4;
+    bitmap_bytes = (bitmap_bytes + 15) & ~15;
+    unsigned int meta_size = bitmap_bytes + total_pages * sizeof(page_frame_t);
+    unsigned int meta_pages = (meta_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    unsigned int kernel_pages = (unsigned int)&kernel_end;
+    if (kernel_pages < 1024 * 1024) kernel_pages = 1024 * 1024;
+    kernel_pages = (kernel_pages + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    unsigned int meta_first = 0;
+    for (unsigned int i = 0; i < region_count && !meta_first; i++) {
+        unsigned int first, last;
+        if (!region_pages(&regions[i], KERNEL_DIRECT_MAP_END, &first, &last)) continue;
+        if (first < kernel_pages) first = kernel_pages;
+        if (first + meta_pages <= last) meta_first = first;
+    }
+    if (!meta_first) {
+        print_string("[ERROR] No room for PMM metadata!\n");
+        total_pages = 0;
+        return;
+    }
+
+    page_bitmap = (unsigned int*)(meta_first * PAGE_SIZE);
+    summary_bitmap = page_bitmap + bitmap_words;
+    frames = (page_frame_t*)(meta_first * PAGE_SIZE + bitmap_bytes);
+
+    print_string("  Usable: ");
+    print_dec(managed_pages);
+    print_string(" pages (");
+    print_dec(managed_pages * 4);
+    print_string(" KB) in ");
+    print_dec(region_count);
+    print_string(" regions\n");
+
+    if (high_pages) {
+        print_string("  High memory: ");
+        print_dec(high_pages);
+        print_string(" pages (");
+        print_dec(high_pages >> 8);
+        print_string(" MB) for user pages\n");
+    }
+
+    print_string("  Metadata: ");
+    print_dec(meta_size);
+    print_string(" bytes at ");
+    print_hex(meta_first * PAGE_SIZE);
+    print_string("\n");
+
+    // Initialize bitmap - mark all as used. Bits past total_pages and
+    // holes stay set forever so the word scans never hand them out.
+    for (unsigned int i = 0; i < bitmap_words; i++) {
+        page_bitmap[i] = 0xFFFFFFFF;
+    }
+    for (unsigned int i = 0; i < summary_words; i++) {
+        summary_bitmap[i] = 0xFFFFFFFF;
+    }
+    used_pages = total_pages;
+    scan_allocs = 0;
+    scan_words = 0;
+
+    for (unsigned int i = 0; i < total_pages; i++) {
+        frames[i].order = BUDDY_ORDER_NONE;
+        frames[i].flags = 0;
+        frames[i].refs = 0;
+    }
+    // Zone boundary is a multiple of 32 * 32 frames (4MB), so each zone
+    // starts on a summary word
+    zones[ZONE_LOW].first_word = 0;
+    zones[ZONE_LOW].end_word = (low_pages + PAGES_PER_WORD - 1) / PAGES_PER_WORD;
+    zones[ZONE_HIGH].first_word = zones[ZONE_LOW].end_word;
+    zones[ZONE_HIGH].end_word = bitmap_words;
+    for (unsigned int bit = 0; bit < PMM_FLAG_COUNT; bit++) flag_pages[bit] = 0;
+    for (unsigned int tag = 0; tag < MEM_TAG_COUNT; tag++) tag_pages[tag] = tag_peak[tag] = 0;
+    lru_head = lru_tail = BUDDY_NIL;
+    lru_pages = 0;
+    zero_pool_count = 0;
+    zero_pool_hits = 0;
+    zero_pool_misses = 0;
+    for (unsigned int z = 0; z < ZONE_COUNT; z++) {
+        zones[z].next_free_word = zones[z].end_word;
+        for (unsigned int o = 0; o <= PMM_MAX_ORDER; o++) {
+            zones[z].free_lists[o] = BUDDY_NIL;
+            zones[z].free_counts[o] = 0;
+        }
+    }
+
+    // Free every usable page except the kernel image, low memory and the
+    // metadata itself
+    unsigned int meta_last = meta_first + meta_pages;
+    for (unsigned int i = 0; i < region_count; i++) {
+        unsigned int first, last;
+        if (!region_pages(&regions[i], PMM_PHYS_LIMIT, &first, &last)) continue;
+        release_clipped(first, last, kernel_pages, meta_first);
+        release_clipped(first, last, meta_last, total_pages);
+    }
+
+    print_string("  Reserved: ");
+    print_dec(used_pages - hole_pages);
+    print_string(" pages for kernel, low memory and PMM metadata\n");
+
     print_string("  Available pages: ");
     print_dec(total_pages - used_pages);
     print_string(" (");
     print_dec((total_pages - used_pages) * 4);
     print_string(" KB)\n");
-    
+
+    print_string("  Buddy orders: 0-");
+    print_dec(PMM_MAX_ORDER);
+    print_string(" (max block ");
+    print_dec((1u << PMM_MAX_ORDER) * 4);
+    print_string(" KB)\n");
+
     print_string("[OK] Physical Memory Manager initialized\n");
 }
 
 // Set page as used
 void pmm_set_page_used(unsigned int address) {
     unsigned int page = address / PAGE_SIZE;
-    unsigned int byte = page / PAGES_PER_BYTE;
-    unsigned int bit = page % PAGES_PER_BYTE;
-    
-    if (byte >= bitmap_size) return;
-    
-    unsigned char was_free = !(page_bitmap[byte] & (1 << bit));
-    page_bitmap[byte] |= (1 << bit);
-    
-    if (was_free) used_pages++;
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    if (page < total_pages && !bitmap_test(page)) {
+        buddy_carve_page(page);
+        bitmap_set_range(page, 1);
+        frame_claim(page, PMM_PAGE_KERNEL | PMM_PAGE_PINNED);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 // Set page as free
 void pmm_set_page_free(unsigned int address) {
     unsigned int page = address / PAGE_SIZE;
-    unsigned int byte = page / PAGES_PER_BYTE;
-    unsigned int bit = page % PAGES_PER_BYTE;
-    
-    if (byte >= bitmap_size) return;
-    
-    unsigned char was_used = page_bitmap[byte] & (1 << bit);
-    page_bitmap[byte] &= ~(1 << bit);
-    
-    if (was_used) used_pages--;
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    if (page < total_pages && bitmap_test(page)) {
+        frame_release(page);
+        bitmap_clear_range(page, 1);
+        buddy_free_block(page, 0);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Take the lowest free page of a zone
+static unsigned int zone_alloc_page(pmm_zone_t* zone, unsigned int flags) {
+    scan_allocs++;
+    unsigned int page = bitmap_find_free(zone);
+    if (page == BUDDY_NIL) return BUDDY_NIL;
+
+    buddy_carve_page(page);
+    bitmap_set_range(page, 1);
+    frame_claim(page, flags);
+    return page;
+}
+
+// Allocated frame for a physical address, or BUDDY_NIL
+static unsigned int frame_of(phys_addr_t address) {
+    unsigned int page = (unsigned int)(address / PAGE_SIZE);
+    if (page >= total_pages || !frames[page].refs) return BUDDY_NIL;
+    return page;
+}
+
+// Clear a direct-mapped frame a dword at a time
+static void zero_frame(unsigned int address) {
+    unsigned int count = PAGE_SIZE / 4;
+    asm volatile("cld; rep stosl"
+                 : "+D"(address), "+c"(count)
+                 : "a"(0)
+                 : "memory");
+}
+
+// Take a frame from the pre-zeroed pool, or BUDDY_NIL
+static unsigned int zero_pool_take(unsigned int flags) {
+    if (!zero_pool_count) return BUDDY_NIL;
+    unsigned int page = zero_pool[--zero_pool_count];
+    frame_claim(page, flags);
+    return page;
 }
 
 // Allocate a single page
 unsigned int pmm_alloc_page() {
-    for (unsigned int i = 0; i < bitmap_size; i++) {
-        if (page_bitmap[i] != 0xFF) {
-            // Found a byte with at least one free page
-            for (unsigned int bit = 0; bit < PAGES_PER_BYTE; bit++) {
-                if (!(page_bitmap[i] & (1 << bit))) {
-                    // Found free page
-                    unsigned int page = i * PAGES_PER_BYTE + bit;
-                    unsigned int address = page * PAGE_SIZE;
-                    pmm_set_page_used(address);
-                    return address;
-                }
-            }
+    return pmm_alloc_page_tagged(MEM_TAG_OTHER);
+}
+
+// Allocate a single kernel page accounted to a MEM_TAG_* owner
+unsigned int pmm_alloc_page_tagged(unsigned int tag) {
+    unsigned int page_flags = PMM_PAGE_KERNEL | PMM_PAGE_TAG(tag);
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int page = zone_alloc_page(&zones[ZONE_LOW], page_flags);
+    // Last resort: the pool holds free memory too
+    if (page == BUDDY_NIL) page = zero_pool_take(page_flags);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    if (page == BUDDY_NIL) return 0;  // No free pages
+    return page * PAGE_SIZE;
+}
+
+// Page from the pre-zeroed pool tagged with flags, 0 if the pool is empty
+unsigned int pmm_alloc_prezeroed_page(unsigned int flags) {
+    unsigned int irq_flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int page = zero_pool_take(flags);
+    if (page == BUDDY_NIL) zero_pool_misses++;
+    else zero_pool_hits++;
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
+    return page == BUDDY_NIL ? 0 : page * PAGE_SIZE;
+}
+
+// Allocate a zeroed, direct-mapped page tagged with flags (PMM_PAGE_KERNEL
+// or PMM_PAGE_USER), zeroing inline only when the pool is empty
+unsigned int pmm_alloc_zeroed_page(unsigned int flags) {
+    unsigned int address = pmm_alloc_prezeroed_page(flags);
+    if (address) return address;
+    unsigned int irq_flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int page = zone_alloc_page(&zones[ZONE_LOW], flags);
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
+    if (page == BUDDY_NIL) return 0;
+    zero_frame(page * PAGE_SIZE);
+    return page * PAGE_SIZE;
+}
+
+// Idle-time work: zero up to max_pages free frames into the pool. Returns
+// the number of frames zeroed, 0 once the pool is full. A frame is taken
+// out of the free lists before zeroing and only then added to the pool,
+// so the lock is never held across the zeroing.
+unsigned int pmm_prezero_pages(unsigned int max_pages) {
+    unsigned int done = 0;
+    while (done < max_pages) {
+        unsigned int flags = spin_lock_irqsave(&pmm_lock);
+        unsigned int page = BUDDY_NIL;
+        if (zero_pool_count < PMM_ZERO_POOL) {
+            scan_allocs++;
+            page = bitmap_find_free(&zones[ZONE_LOW]);
+        }
+        if (page != BUDDY_NIL) {
+            buddy_carve_page(page);
+            bitmap_set_range(page, 1);
+        }
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        if (page == BUDDY_NIL) break;
+
+        zero_frame(page * PAGE_SIZE);
+        flags = spin_lock_irqsave(&pmm_lock);
+        int pooled = zero_pool_count < PMM_ZERO_POOL;
+        if (pooled) {
+            zero_pool[zero_pool_count++] = page;
+        } else {
+            // Another CPU filled the pool meanwhile
+            bitmap_clear_range(page, 1);
+            buddy_free_block(page, 0);
         }
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        if (!pooled) break;
+        done++;
     }
-    
-    // No free pages
-    return 0;
+    return done;
+}
+
+// Allocate a page for user memory: high memory first, so the direct-mapped
+// zone stays available for the kernel
+phys_addr_t pmm_alloc_user_page() {
+    unsigned int page_flags = PMM_PAGE_USER | PMM_PAGE_TAG(MEM_TAG_PROCESS);
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int page = zone_alloc_page(&zones[ZONE_HIGH], page_flags);
+    if (page == BUDDY_NIL) page = zone_alloc_page(&zones[ZONE_LOW], page_flags);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    if (page == BUDDY_NIL) return 0;
+    return (phys_addr_t)page * PAGE_SIZE;
+}
+
+// Drop a reference to an allocated frame (pmm_lock held), freeing it with
+// the last one. A frame that is already free is left alone, so a stray
+// extra put cannot release a frame someone else has since allocated.
+static void frame_put(unsigned int page) {
+    if (page == BUDDY_NIL || !bitmap_test(page)) return;
+    if (frames[page].refs > 1) {
+        frames[page].refs--;
+        return;
+    }
+    frame_release(page);
+    bitmap_clear_range(page, 1);
+    buddy_free_block(page, 0);
 }
 
-// Free a single page
+// Free a single page: drop the caller's reference, as pmm_put_page does,
+// so a page still shared (copy-on-write) stays with its other users
 void pmm_free_page(unsigned int address) {
-    pmm_set_page_free(address);
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    frame_put(frame_of(address));
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Add a reference to an allocated page
+void pmm_share_page(phys_addr_t address) {
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int page = frame_of(address);
+    if (page != BUDDY_NIL && frames[page].refs != 0xFFFF) frames[page].refs++;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Drop a reference; the page is freed when its last user lets go
+void pmm_put_page(phys_addr_t address) {
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    frame_put(frame_of(address));
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Number of extra references to a page (0 = exclusively owned)
+unsigned int pmm_page_shares(phys_addr_t address) {
+    unsigned int page = frame_of(address);
+    if (page == BUDDY_NIL) return 0;
+    return frames[page].refs - 1u;
+}
+
+// References held on a page, 0 if it is free
+unsigned int pmm_page_refs(phys_addr_t address) {
+    unsigned int page = frame_of(address);
+    return page == BUDDY_NIL ? 0 : frames[page].refs;
+}
+
+unsigned int pmm_page_flags(phys_addr_t address) {
+    unsigned int page = frame_of(address);
+    return page == BUDDY_NIL ? 0 : frames[page].flags & PMM_PAGE_ALL;
+}
+
+// Set and clear PMM_PAGE_* flags of an allocated page
+void pmm_update_page_flags(phys_addr_t address, unsigned int set, unsigned int clear) {
+    unsigned int irq_flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int page = frame_of(address);
+    if (page != BUDDY_NIL) {
+        unsigned int flags = frames[page].flags;
+        frame_set_flags(page, (((flags & ~clear) | set) & PMM_PAGE_ALL) | (flags & ~PMM_PAGE_ALL));
+    }
+    spin_unlock_irqrestore(&pmm_lock, irq_flags);
+}
+
+// Mark a user page as recently used: it moves to the tail of the LRU list
+void pmm_touch_page(phys_addr_t address) {
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int page = frame_of(address);
+    if (page != BUDDY_NIL && (frames[page].flags & PMM_PAGE_USER)) {
+        lru_unlink(page);
+        lru_append(page);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Least recently used user page that is not pinned, 0 if there is none
+phys_addr_t pmm_lru_oldest() {
+    phys_addr_t oldest = 0;
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    for (unsigned int page = lru_head; page != BUDDY_NIL; page = frames[page].next) {
+        if (!(frames[page].flags & PMM_PAGE_PINNED)) {
+            oldest = (phys_addr_t)page * PAGE_SIZE;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return oldest;
 }
 
 // Allocate multiple contiguous pages
 unsigned int pmm_alloc_pages(unsigned int count) {
     if (count == 0) return 0;
     if (count == 1) return pmm_alloc_page();
-    
-    unsigned int start_page = 0;
-    unsigned int found_count = 0;
-    
-    for (unsigned int page = 0; page < total_pages; page++) {
-        unsigned int byte = page / PAGES_PER_BYTE;
-        unsigned int bit = page % PAGES_PER_BYTE;
-        
-        if (byte >= bitmap_size) break;
-        
-        if (!(page_bitmap[byte] & (1 << bit))) {
-            // Free page
-            if (found_count == 0) {
-                start_page = page;
-            }
-            found_count++;
-            
-            if (found_count == count) {
-                // Found enough contiguous pages
-                for (unsigned int i = 0; i < count; i++) {
-                    pmm_set_page_used((start_page + i) * PAGE_SIZE);
-                }
-                return start_page * PAGE_SIZE;
-            }
-        } else {
-            // Used page, reset counter
-            found_count = 0;
-        }
+    if (count > (1u << PMM_MAX_ORDER)) return 0;
+
+    unsigned int order = buddy_order_for(count);
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int page = buddy_alloc_block(&zones[ZONE_LOW], order);
+    if (page == BUDDY_NIL) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0;  // No block large enough
     }
-    
-    // Not enough contiguous pages
-    return 0;
+
+    // Hand back the unused tail so pmm_free_pages(address, count) is exact
+    unsigned int block_pages = 1u << order;
+    if (block_pages > count) {
+        buddy_free_range(page + count, block_pages - count);
+    }
+
+    bitmap_set_range(page, count);
+    for (unsigned int i = 0; i < count; i++) frame_claim(page + i, PMM_PAGE_KERNEL);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return page * PAGE_SIZE;
 }
 
 // Free multiple contiguous pages
 void pmm_free_pages(unsigned int address, unsigned int count) {
-    for (unsigned int i = 0; i < count; i++) {
-        pmm_free_page(address + (i * PAGE_SIZE));
+    unsigned int page = address / PAGE_SIZE;
+    if (page >= total_pages) return;
+    if (page + count > total_pages) count = total_pages - page;
+
+    // Only release pages that are actually allocated; runs of them are
+    // handed to the buddy allocator in one go so they coalesce cheaply
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int i = 0;
+    while (i < count) {
+        if (!bitmap_test(page + i)) { i++; continue; }
+        unsigned int run = i;
+        while (run < count && bitmap_test(page + run)) run++;
+        for (unsigned int j = i; j < run; j++) frame_release(page + j);
+        bitmap_clear_range(page + i, run - i);
+        buddy_free_range(page + i, run - i);
+        i = run;
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
-// Get total pages
+// Get total pages (usable RAM only)
 unsigned int pmm_get_total_pages() {
-    return total_pages;
+    return total_pages - hole_pages;
 }
 
-// Get used pages
+// Get used pages (the pre-zeroed pool counts as free)
 unsigned int pmm_get_used_pages() {
-    return used_pages;
+    return used_pages - hole_pages - zero_pool_count;
 }
 
 // Get free pages
 unsigned int pmm_get_free_pages() {
-    return total_pages - used_pages;
+    return total_pages - used_pages + zero_pool_count;
+}
+
+// Memory totals in KB; byte counts would overflow past 4GB with PAE
+unsigned int pmm_get_total_kb() {
+    return (total_pages - hole_pages) * (PAGE_SIZE / 1024);
+}
+
+unsigned int pmm_get_used_kb() {
+    return pmm_get_used_pages() * (PAGE_SIZE / 1024);
+}
+
+unsigned int pmm_get_free_kb() {
+    return pmm_get_free_pages() * (PAGE_SIZE / 1024);
+}
+
+// End of the managed low memory; the direct map has to cover all of it
+unsigned int pmm_get_memory_end() {
+    return low_pages * PAGE_SIZE;
+}
+
+// Get number of free buddy blocks of the given order
+unsigned int pmm_get_free_blocks(unsigned int order) {
+    if (order > PMM_MAX_ORDER) return 0;
+    unsigned int count = 0;
+    for (unsigned int z = 0; z < ZONE_COUNT; z++) count += zones[z].free_counts[order];
+    return count;
+}
+
+// Get single-page allocation count and total bitmap words scanned for them
+void pmm_get_scan_stats(unsigned int* allocs, unsigned int* words) {
+    *allocs = scan_allocs;
+    *words = scan_words;
+}
+
+// Allocated pages carrying a PMM_PAGE_* flag
+unsigned int pmm_get_flag_pages(unsigned int flag) {
+    for (unsigned int bit = 0; bit < PMM_FLAG_COUNT; bit++) {
+        if (flag == (1u << bit)) return flag_pages[bit];
+    }
+    return 0;
 }
 
-// Get total memory
-unsigned int pmm_get_total_memory() {
-    return total_pages * PAGE_SIZE;
+// Pages on the user LRU list
+unsigned int pmm_get_lru_pages() {
+    return lru_pages;
 }
 
-// Get used memory
-unsigned int pmm_get_used_memory() {
-    return used_pages * PAGE_SIZE;
+// Pre-zeroed pool size and how often pmm_alloc_zeroed_page found it empty
+void pmm_get_zero_stats(unsigned int* pooled, unsigned int* hits, unsigned int* misses) {
+    if (pooled) *pooled = zero_pool_count;
+    if (hits) *hits = zero_pool_hits;
+    if (misses) *misses = zero_pool_misses;
 }
 
-// Get free memory
-unsigned int pmm_get_free_memory() {
-    return (total_pages - used_pages) * PAGE_SIZE;
+// Pages currently held and the peak for a MEM_TAG_* owner
+void pmm_get_tag_stats(unsigned int tag, unsigned int* pages, unsigned int* peak) {
+    if (tag >= MEM_TAG_COUNT) tag = MEM_TAG_OTHER;
+    if (pages) *pages = tag_pages[tag];
+    if (peak) *peak = tag_peak[tag];
 }
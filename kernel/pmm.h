@@ -4,17 +4,67 @@
 #ifndef PMM_H
 #define PMM_H
 
+#include "memtag.h"
+
+// Largest buddy block is 2^PMM_MAX_ORDER pages (4MB)
+#define PMM_MAX_ORDER 10
+
+// Physical addresses go past 4GB in PAE builds
+#ifdef CONFIG_PAE
+typedef unsigned long long phys_addr_t;
+#else
+typedef unsigned int phys_addr_t;
+#endif
+
+// Frame descriptor flags. Allocations are tagged kernel or user; the
+// rest are set by their owners through pmm_update_page_flags.
+#define PMM_PAGE_KERNEL     0x01
+#define PMM_PAGE_USER       0x02    // on the LRU list
+#define PMM_PAGE_PAGECACHE  0x04
+#define PMM_PAGE_PINNED     0x08    // never picked by pmm_lru_oldest
+#define PMM_PAGE_DIRTY      0x10
+#define PMM_PAGE_ALL        0x1F
+
+// The owning MEM_TAG_* rides in the top bits of the flags
+#define PMM_PAGE_TAG(tag)     (((tag) & 7) << 5)
+#define PMM_PAGE_TAG_OF(flags) (((flags) >> 5) & 7)
+
 // Initialize physical memory manager
 void pmm_init();
 
-// Page allocation
+// Page allocation. Kernel pages always come from the direct map.
 unsigned int pmm_alloc_page();
+unsigned int pmm_alloc_page_tagged(unsigned int tag);
 void pmm_free_page(unsigned int address);
 
-// Multiple page allocation
+// Zeroed page from the idle-filled pool (falls back to zeroing inline);
+// flags is PMM_PAGE_KERNEL or PMM_PAGE_USER plus an optional PMM_PAGE_TAG
+unsigned int pmm_alloc_zeroed_page(unsigned int flags);
+unsigned int pmm_alloc_prezeroed_page(unsigned int flags);  // 0 if the pool is empty
+unsigned int pmm_prezero_pages(unsigned int max_pages);
+
+// User page allocation, may return memory above the direct map (and above
+// 4GB with PAE). Release with pmm_put_page.
+phys_addr_t pmm_alloc_user_page();
+
+// Physically contiguous allocation, for DMA buffers; everything else
+// should use vmalloc
 unsigned int pmm_alloc_pages(unsigned int count);
 void pmm_free_pages(unsigned int address, unsigned int count);
 
+// Reference counting: allocation gives one reference, pmm_share_page adds
+// one (copy-on-write, shared memory), pmm_put_page frees on the last
+void pmm_share_page(phys_addr_t address);
+void pmm_put_page(phys_addr_t address);
+unsigned int pmm_page_shares(phys_addr_t address);
+unsigned int pmm_page_refs(phys_addr_t address);
+
+// Frame descriptor flags and the user page LRU list
+unsigned int pmm_page_flags(phys_addr_t address);
+void pmm_update_page_flags(phys_addr_t address, unsigned int set, unsigned int clear);
+void pmm_touch_page(phys_addr_t address);
+phys_addr_t pmm_lru_oldest();
+
 // Page status
 void pmm_set_page_used(unsigned int address);
 void pmm_set_page_free(unsigned int address);
@@ -23,8 +73,15 @@ void pmm_set_page_free(unsigned int address);
 unsigned int pmm_get_total_pages();
 unsigned int pmm_get_used_pages();
 unsigned int pmm_get_free_pages();
-unsigned int pmm_get_total_memory();
-unsigned int pmm_get_used_memory();
-unsigned int pmm_get_free_memory();
+unsigned int pmm_get_total_kb();
+unsigned int pmm_get_used_kb();
+unsigned int pmm_get_free_kb();
+unsigned int pmm_get_memory_end();
+unsigned int pmm_get_free_blocks(unsigned int order);
+void pmm_get_scan_stats(unsigned int* allocs, unsigned int* words);
+unsigned int pmm_get_flag_pages(unsigned int flag);
+unsigned int pmm_get_lru_pages();
+void pmm_get_tag_stats(unsigned int tag, unsigned int* pages, unsigned int* peak);
+void pmm_get_zero_stats(unsigned int* pooled, unsigned int* hits, unsigned int* misses);
 
 #endif
@@ -2,46 +2,145 @@
 // Copyright (c) 2025 SUB OS Project
 
 #include "process.h"
-#include "heap.h"
+#include "smp.h"
+#include "slab.h"
 #include "pmm.h"
+#include "paging.h"
+#include "vma.h"
+#include "tss.h"
+#include "timer.h"
+#include "spinlock.h"
 #include "kernel.h"
 
 extern void enter_usermode(unsigned int entry_point, unsigned int user_stack);
+extern void fork_return();
+extern void switch_to_task(registers_t* prev, registers_t* next);
+extern void task_start();
 
+// Running and idle process, zombies and switch bookkeeping are per CPU
+// (smp.h); the process list is shared
 static process_t* process_list = 0;
-static process_t* current_process = 0;
-static unsigned int next_pid = 0;
-static process_t* idle_process = 0;
+static spinlock_t process_list_lock;
+static atomic_t next_pid = ATOMIC_INIT(0);
+static kmem_cache_t* process_cache = 0;
+
+// Frames the idle process zeroes per wakeup (one timer tick at most)
+#define IDLE_PREZERO_BATCH 8
+
+static unsigned int alloc_pid() {
+    return (unsigned int)atomic_add_return(&next_pid, 1) - 1;
+}
+
+static unsigned int read_tsc() {
+    unsigned int low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return low;
+}
+
+// Lay out the frame switch_to_task pops for a task that has never run:
+// EFLAGS, the callee-saved registers, then task_start, which finishes
+// the switch and returns to resume
+static void push_switch_frame(process_t* process, unsigned int* stack,
+                              unsigned int resume) {
+    *--stack = resume;
+    *--stack = (unsigned int)task_start;
+    *--stack = 0;      // EBP
+    *--stack = 0;      // EBX
+    *--stack = 0;      // ESI
+    *--stack = 0;      // EDI
+    *--stack = 0x202;  // EFLAGS, interrupts on
+    process->registers.esp = (unsigned int)stack;
+    process->registers.ebp = 0;
+}
+
+static void process_list_add(process_t* process) {
+    unsigned int flags = spin_lock_irqsave(&process_list_lock);
+    process->all_next = process_list;
+    process_list = process;
+    spin_unlock_irqrestore(&process_list_lock, flags);
+}
+
+// A kernel thread whose entry function returns ends up here
+static void process_thread_exit() {
+    process_terminate(process_get_current());
+    schedule();
+}
+
+// The calling CPU's idle process: its boot context, which never sits on
+// a run queue and only runs when nothing else is ready
+process_t* process_create_idle(const char* name) {
+    process_t* idle = (process_t*)kmem_cache_alloc(process_cache);
+    if (!idle) return 0;
+    idle->pid = alloc_pid();
+    int i;
+    for (i = 0; name[i] && i < 31; i++) {
+        idle->name[i] = name[i];
+    }
+    idle->name[i] = 0;
+    idle->state = PROCESS_RUNNING;
+    idle->privilege = PROCESS_KERNEL;
+    idle->priority = SCHED_PRIO_IDLE;
+    idle->quantum = 1;
+    idle->cpu_time = 0;
+    idle->ticks_left = 0;
+    idle->sched_bonus = 0;
+    idle->run_level = SCHED_NOT_QUEUED;
+    idle->run_next = 0;
+    idle->run_prev = 0;
+    idle->kernel_stack = 0;
+    idle->user_stack = 0;
+    idle->page_directory = 0;
+    idle->registers.cr3 = 0;  // borrows the previous address space
+    idle->vm_areas = 0;
+    idle->minor_faults = 0;
+    idle->syscall_frame = 0;
+    fpu_process_init(idle);
+    idle->cpu = this_cpu()->index;
+    idle->on_cpu = 1;
+    process_list_add(idle);
+    return idle;
+}
 
 void process_init() {
     print_string("[OK] Initializing Process Management...\n");
-    idle_process = (process_t*)kmalloc(sizeof(process_t));
-    idle_process->pid = next_pid++;
-    const char* idle_name = "idle";
-    int i;
-    for (i = 0; idle_name[i] && i < 31; i++) {
-        idle_process->name[i] = idle_name[i];
-    }
-    idle_process->name[i] = 0;
-    idle_process->state = PROCESS_RUNNING;
-    idle_process->privilege = PROCESS_KERNEL;
-    idle_process->priority = 0;
-    idle_process->quantum = 1;
-    idle_process->cpu_time = 0;
-    idle_process->next = idle_process;
-    process_list = idle_process;
-    current_process = idle_process;
+    spin_lock_init(&process_list_lock, "process_list");
+    process_cache = kmem_cache_create("process", sizeof(process_t), 0, 0);
+    cpu_t* cpu = this_cpu();
+    cpu->idle = process_create_idle("idle");
+    cpu->current = cpu->idle;
     print_string("  Created idle process (PID 0)\n");
     print_string("[OK] Process Management initialized\n");
 }
 
+// Called by the idle process whenever it waits: do a little background
+// work, then sleep until the next interrupt. With nothing else runnable
+// the periodic tick is stopped until the next timer is due.
+void process_idle() {
+    cpu_t* cpu = this_cpu();
+    if (cpu->current != cpu->idle || cpu->index != 0) {
+        // Only the boot CPU owns the PIT
+        asm volatile("sti; hlt");
+        return;
+    }
+    pmm_prezero_pages(IDLE_PREZERO_BATCH);
+
+    asm volatile("cli");
+    if (scheduler_runnable() || !timer_idle_enter()) {
+        asm volatile("sti; hlt");
+        return;
+    }
+    asm volatile("sti; hlt; cli");
+    timer_idle_exit();
+    asm volatile("sti");
+}
+
 process_t* process_create(const char* name, void (*entry_point)()) {
-    process_t* process = (process_t*)kmalloc(sizeof(process_t));
+    process_t* process = (process_t*)kmem_cache_alloc(process_cache);
     if (!process) {
         print_string("[ERROR] Failed to allocate process!\n");
         return 0;
     }
-    process->pid = next_pid++;
+    process->pid = alloc_pid();
     int i;
     for (i = 0; name[i] && i < 31; i++) {
         process->name[i] = name[i];
@@ -49,35 +148,47 @@ process_t* process_create(const char* name, void (*entry_point)()) {
     process->name[i] = 0;
     process->state = PROCESS_READY;
     process->privilege = PROCESS_KERNEL;
-    process->priority = 10;
-    process->quantum = 5;
+    process->priority = SCHED_PRIO_DEFAULT;
+    process->quantum = SCHED_QUANTUM;
     process->cpu_time = 0;
-    process->kernel_stack = pmm_alloc_page();
+    process->ticks_left = 0;
+    process->sched_bonus = 0;
+    process->run_level = SCHED_NOT_QUEUED;
+    process->run_next = 0;
+    process->run_prev = 0;
+    process->cpu = this_cpu()->index;
+    process->on_cpu = 0;
+    process->user_stack = 0;
+    // Kernel threads have no user half of their own: they keep running on
+    // whatever address space is loaded, so switching to them needs no CR3
+    // reload and no TLB refill
+    process->page_directory = 0;
+    process->registers.cr3 = 0;
+    process->vm_areas = 0;
+    process->minor_faults = 0;
+    process->syscall_frame = 0;
+    fpu_process_init(process);
+    process->kernel_stack = pmm_alloc_zeroed_page(PMM_PAGE_KERNEL | PMM_PAGE_TAG(MEM_TAG_PROCESS));
     if (process->kernel_stack == 0) {
-        kfree(process);
+        kmem_cache_free(process_cache, process);
         print_string("[ERROR] Failed to allocate stack!\n");
         return 0;
     }
     unsigned int* stack = (unsigned int*)(process->kernel_stack + 4096);
-    stack--;
-    *stack = 0x202;
-    stack--;
-    *stack = 0x08;
-    stack--;
-    *stack = (unsigned int)entry_point;
-    process->registers.esp = (unsigned int)stack;
-    process->registers.ebp = process->kernel_stack + 4096;
+    *--stack = (unsigned int)process_thread_exit;
+    push_switch_frame(process, stack, (unsigned int)entry_point);
+    process_list_add(process);
     scheduler_add(process);
     return process;
 }
 
 process_t* process_create_user(const char* name, void (*entry_point)()) {
-    process_t* process = (process_t*)kmalloc(sizeof(process_t));
+    process_t* process = (process_t*)kmem_cache_alloc(process_cache);
     if (!process) {
         print_string("[ERROR] Failed to allocate user process!\n");
         return 0;
     }
-    process->pid = next_pid++;
+    process->pid = alloc_pid();
     int i;
     for (i = 0; name[i] && i < 31; i++) {
         process->name[i] = name[i];
@@ -85,51 +196,220 @@ process_t* process_create_user(const char* name, void (*entry_point)()) {
     process->name[i] = 0;
     process->state = PROCESS_READY;
     process->privilege = PROCESS_USER;
-    process->priority = 10;
-    process->quantum = 5;
+    process->priority = SCHED_PRIO_DEFAULT;
+    process->quantum = SCHED_QUANTUM;
     process->cpu_time = 0;
-    process->kernel_stack = pmm_alloc_page();
+    process->ticks_left = 0;
+    process->sched_bonus = 0;
+    process->run_level = SCHED_NOT_QUEUED;
+    process->run_next = 0;
+    process->run_prev = 0;
+    process->cpu = this_cpu()->index;
+    process->on_cpu = 0;
+    process->vm_areas = 0;
+    process->minor_faults = 0;
+    process->syscall_frame = 0;
+    fpu_process_init(process);
+    process->kernel_stack = pmm_alloc_zeroed_page(PMM_PAGE_KERNEL | PMM_PAGE_TAG(MEM_TAG_PROCESS));
     if (process->kernel_stack == 0) {
-        kfree(process);
+        kmem_cache_free(process_cache, process);
         print_string("[ERROR] Failed to allocate kernel stack!\n");
         return 0;
     }
-    process->user_stack = pmm_alloc_page();
-    if (process->user_stack == 0) {
+    process->page_directory = paging_create_directory();
+    if (process->page_directory == 0) {
         pmm_free_page(process->kernel_stack);
-        kfree(process);
-        print_string("[ERROR] Failed to allocate user stack!\n");
+        kmem_cache_free(process_cache, process);
+        print_string("[ERROR] Failed to allocate address space!\n");
         return 0;
     }
-    unsigned int user_esp = process->user_stack + 4096;
+    process->registers.cr3 = process->page_directory;
+
+    // Stack and heap are only reserved here; page_fault backs each page
+    // with a zeroed frame the first time it is touched
+    if (!vma_add(&process->vm_areas, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_TOP,
+                 VMA_USER | VMA_WRITE | VMA_STACK) ||
+        !vma_add(&process->vm_areas, USER_HEAP_START, USER_HEAP_START + USER_HEAP_SIZE,
+                 VMA_USER | VMA_WRITE | VMA_HEAP)) {
+        vma_free_all(&process->vm_areas);
+        paging_destroy_directory(process->page_directory);
+        pmm_free_page(process->kernel_stack);
+        kmem_cache_free(process_cache, process);
+        print_string("[ERROR] Failed to reserve user memory!\n");
+        return 0;
+    }
+    process->user_stack = USER_STACK_TOP;
+    unsigned int user_esp = process->user_stack;
+    // enter_usermode(entry_point, user_esp) is entered by a ret, so it
+    // needs a (never used) return address below its arguments
     unsigned int* kstack = (unsigned int*)(process->kernel_stack + 4096);
-    kstack--;
-    *kstack = user_esp;
-    kstack--;
-    *kstack = (unsigned int)entry_point;
-    kstack--;
-    *kstack = (unsigned int)enter_usermode;
-    process->registers.esp = (unsigned int)kstack;
-    process->registers.ebp = process->kernel_stack + 4096;
+    *--kstack = user_esp;
+    *--kstack = (unsigned int)entry_point;
+    *--kstack = 0;
+    push_switch_frame(process, kstack, (unsigned int)enter_usermode);
+    process_list_add(process);
     scheduler_add(process);
     return process;
 }
 
-process_t* process_get_current() { return current_process; }
+// Duplicate a user process. The child shares the parent's frames
+// copy-on-write and resumes from a copy of the parent's syscall frame
+// (words long) through fork_return, which makes fork() return 0 there.
+process_t* process_fork(process_t* parent, const unsigned int* frame, unsigned int words) {
+    if (!parent || !parent->page_directory) return 0;
+    process_t* process = (process_t*)kmem_cache_alloc(process_cache);
+    if (!process) {
+        print_string("[ERROR] Failed to allocate process!\n");
+        return 0;
+    }
+    process->pid = alloc_pid();
+    for (int i = 0; i < 32; i++) {
+        process->name[i] = parent->name[i];
+    }
+    process->state = PROCESS_READY;
+    process->privilege = parent->privilege;
+    process->priority = parent->priority;
+    process->quantum = parent->quantum;
+    process->cpu_time = 0;
+    process->ticks_left = 0;
+    process->sched_bonus = 0;
+    process->run_level = SCHED_NOT_QUEUED;
+    process->run_next = 0;
+    process->run_prev = 0;
+    process->cpu = this_cpu()->index;
+    process->on_cpu = 0;
+    process->user_stack = parent->user_stack;
+    process->vm_areas = 0;
+    process->minor_faults = 0;
+    process->syscall_frame = 0;
+    fpu_fork(process, parent);
+    process->kernel_stack = pmm_alloc_zeroed_page(PMM_PAGE_KERNEL | PMM_PAGE_TAG(MEM_TAG_PROCESS));
+    if (process->kernel_stack == 0) {
+        kmem_cache_free(process_cache, process);
+        print_string("[ERROR] Failed to allocate kernel stack!\n");
+        return 0;
+    }
+    process->page_directory = paging_clone_directory(parent->page_directory);
+    if (process->page_directory == 0 || !vma_clone(&process->vm_areas, parent->vm_areas)) {
+        if (process->page_directory) paging_destroy_directory(process->page_directory);
+        pmm_free_page(process->kernel_stack);
+        kmem_cache_free(process_cache, process);
+        print_string("[ERROR] Failed to clone address space!\n");
+        return 0;
+    }
+    process->registers.cr3 = process->page_directory;
+
+    unsigned int* kstack = (unsigned int*)(process->kernel_stack + 4096);
+    kstack -= words;
+    for (unsigned int i = 0; i < words; i++) {
+        kstack[i] = frame[i];
+    }
+    push_switch_frame(process, kstack, (unsigned int)fork_return);
+    process_list_add(process);
+    scheduler_add(process);
+    return process;
+}
+
+process_t* process_get_current() { return this_cpu()->current; }
+
+process_t* process_get_first() { return process_list; }
+
+process_t* process_get_idle() { return this_cpu()->idle; }
+
+static void process_free(process_t* process) {
+    if (process->kernel_stack) pmm_free_page(process->kernel_stack);
+    if (process->page_directory) paging_destroy_directory(process->page_directory);
+    vma_free_all(&process->vm_areas);
+    kmem_cache_free(process_cache, process);
+}
+
+// Free processes that exited on this CPU, now that they are off it
+static void process_reap() {
+    cpu_t* cpu = this_cpu();
+    process_t** link = &cpu->zombies;
+    while (*link) {
+        process_t* zombie = *link;
+        if (zombie == cpu->current || zombie->on_cpu) {
+            link = &zombie->all_next;
+            continue;
+        }
+        *link = zombie->all_next;
+        process_free(zombie);
+    }
+}
 
 void process_terminate(process_t* process) {
-    if (!process) return;
+    if (!process || process == process_get_idle()) return;
     process->state = PROCESS_TERMINATED;
-    if (process->kernel_stack) pmm_free_page(process->kernel_stack);
-    if (process->user_stack) pmm_free_page(process->user_stack);
     scheduler_remove(process);
-    kfree(process);
+
+    unsigned int flags = spin_lock_irqsave(&process_list_lock);
+    process_t** link = &process_list;
+    while (*link && *link != process) link = &(*link)->all_next;
+    if (*link) *link = process->all_next;
+    spin_unlock_irqrestore(&process_list_lock, flags);
+
+    // A process exiting itself is still running on its kernel stack and
+    // address space; keep them until the next switch has left them. One
+    // waiting in a deque is freed by whichever CPU takes it out.
+    if (process == process_get_current()) {
+        cpu_t* cpu = this_cpu();
+        process->all_next = cpu->zombies;
+        cpu->zombies = process;
+        return;
+    }
+    if (process->run_level == SCHED_IN_DEQUE) return;
+    process_free(process);
 }
 
+// Queue a terminated process that was found in a deque for freeing
+void process_bury(process_t* process) {
+    cpu_t* cpu = this_cpu();
+    process->run_level = SCHED_NOT_QUEUED;
+    process->all_next = cpu->zombies;
+    cpu->zombies = process;
+}
+
+// Hand the CPU to next. Returns when the calling process is switched back
+// in, possibly on another CPU; the time from here to the first
+// instruction after the switch is recorded as the switch cost.
 void process_switch(process_t* next) {
-    if (!next || next == current_process) return;
-    process_t* prev = current_process;
-    current_process = next;
-    prev->state = PROCESS_READY;
+    cpu_t* cpu = this_cpu();
+    if (!next || next == cpu->current) return;
+    process_reap();
+    process_t* prev = cpu->current;
+
+    // A process stolen from another CPU may still be saving its context
+    // there; its stack is not ours to load until that finishes. Idle
+    // processes never leave their CPU.
+    while (next != cpu->idle && __atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+        smp_tlb_poll();
+        cpu_relax();
+    }
+    next->on_cpu = 1;
+    next->cpu = cpu->index;
+    cpu->current = next;
+    if (prev->state == PROCESS_RUNNING) prev->state = PROCESS_READY;
     next->state = PROCESS_RUNNING;
+
+    // Ring 3 -> 0 transitions of next land on its own kernel stack
+    if (next->kernel_stack) tss_set_kernel_stack(next->kernel_stack + 4096);
+
+    fpu_switch(prev, next);
+    cpu->switch_prev = prev;
+    cpu->switch_stamp = read_tsc();
+    switch_to_task(&prev->registers, &next->registers);
+    process_finish_switch();
+}
+
+// First thing a process does once switched in (task_start runs it for
+// new ones): account the switch and release the previous process, which
+// may now be picked up by another CPU
+void process_finish_switch() {
+    cpu_t* cpu = this_cpu();
+    scheduler_account_switch(read_tsc() - cpu->switch_stamp);
+    process_t* prev = cpu->switch_prev;
+    cpu->switch_prev = 0;
+    if (prev && prev != cpu->idle) __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+    process_reap();
 }
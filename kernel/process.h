@@ -4,6 +4,18 @@
 #ifndef PROCESS_H
 #define PROCESS_H
 
+#include "deque.h"
+#include "fpu.h"
+
+// Scheduling: level 0 is the most urgent
+#define SCHED_LEVELS        32
+#define SCHED_PRIO_DEFAULT  10
+#define SCHED_PRIO_IDLE     (SCHED_LEVELS - 1)
+#define SCHED_MAX_BONUS     5       // levels gained by blocking, lost by hogging
+#define SCHED_QUANTUM       5       // ticks
+#define SCHED_NOT_QUEUED    0xFFFFFFFF  // run_level of a process off the queues
+#define SCHED_IN_DEQUE      0xFFFFFFFE  // run_level while it can be stolen
+
 typedef enum {
     PROCESS_READY,
     PROCESS_RUNNING,
@@ -25,6 +37,8 @@ typedef struct {
     unsigned int cr3;
 } registers_t;
 
+struct vm_area;
+
 typedef struct process {
     unsigned int pid;
     char name[32];
@@ -34,23 +48,70 @@ typedef struct process {
     unsigned int kernel_stack;
     unsigned int user_stack;
     unsigned int page_directory;
-    unsigned long priority;
-    unsigned long quantum;
-    unsigned long cpu_time;
-    struct process* next;
+    unsigned long priority;         // base level, 0 .. SCHED_LEVELS-1
+    unsigned long quantum;          // ticks per time slice
+    unsigned long cpu_time;         // ticks spent running
+    unsigned long ticks_left;       // of the current slice
+    int sched_bonus;                // interactivity, +-SCHED_MAX_BONUS
+    unsigned int run_level;         // run queue it is on, if any
+    struct vm_area* vm_areas;       // reserved user ranges, sorted
+    unsigned int minor_faults;      // pages backed on first touch
+    void* syscall_frame;            // system call being serviced (fork copies it)
+    int fpu_used;                   // fpu holds its state (else it never used the FPU)
+    unsigned int fpu_cpu;           // CPU that last loaded fpu, or FPU_NO_CPU
+    fpu_state_t fpu;
+    unsigned int cpu;               // CPU it last ran on
+    volatile int on_cpu;            // running, or not yet switched out
+    struct process* run_next;       // run queue links
+    struct process* run_prev;
+    struct process* all_next;       // list of every live process
 } process_t;
 
+// One CPU's share of the scheduler. The priority queues are only touched
+// by their own CPU; work enters through the deque, where idle CPUs can
+// steal it before the owner drains it into the queues.
+typedef struct {
+    process_t* heads[SCHED_LEVELS];
+    process_t* tails[SCHED_LEVELS];
+    unsigned int bitmap;            // non-empty levels
+    int need_resched;
+    deque_t incoming;
+    unsigned long steals;           // processes taken from other CPUs
+} runqueue_t;
+
 void process_init();
 process_t* process_create(const char* name, void (*entry_point)());
 process_t* process_create_user(const char* name, void (*entry_point)());
+process_t* process_fork(process_t* parent, const unsigned int* frame, unsigned int words);
 void process_terminate(process_t* process);
+void process_bury(process_t* process);
 process_t* process_get_current();
+process_t* process_get_first();
+process_t* process_get_idle();
 void process_switch(process_t* next);
+void process_finish_switch();
+void process_idle();
+process_t* process_create_idle(const char* name);
+
+void runqueue_init(runqueue_t* rq);
 
 void scheduler_init();
 void scheduler_add(process_t* process);
 void scheduler_remove(process_t* process);
 process_t* scheduler_next();
 void schedule();
+void schedule_preempt();
+void scheduler_tick();
+int scheduler_need_resched();
+int scheduler_runnable();
+void scheduler_block(process_t* process);
+void scheduler_wake(process_t* process);
+int scheduler_unblock(process_t* process);
+unsigned long scheduler_get_switches();
+unsigned long scheduler_get_cr3_loads();
+void scheduler_account_switch(unsigned int cycles);
+unsigned int scheduler_get_switch_cycles();
+unsigned int scheduler_get_switch_cycles_min();
+unsigned long scheduler_get_steals();
 
 #endif
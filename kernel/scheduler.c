@@ -1,104 +1,344 @@
-// SUB OS - Scheduler (Round-Robin)
+// SUB OS - Scheduler (O(1) Priority Levels)
 // Copyright (c) 2025 SUB OS Project
+//
+// Ready processes sit on one of SCHED_LEVELS FIFO queues, level 0 being
+// the most urgent. A bitmap records which levels are non-empty, so picking
+// the next process is a single bsf, and the doubly linked queue nodes make
+// enqueue and removal O(1) as well.
+//
+// A process runs at its base priority minus a bonus. Blocking (waiting for
+// input or a timer) earns a level of bonus, using up a whole quantum costs
+// one, so interactive processes float above CPU hogs of the same base
+// priority. Round-robin applies within a level.
+//
+// Every CPU has its own set of queues (runqueue_t), touched only by that
+// CPU. Processes made runnable on a CPU go into its work-stealing deque
+// first, and a process preempted while others wait is put back there when
+// some CPU is idle. The owner drains its deque into the queues whenever it
+// schedules; until then idle CPUs can steal from it without locks.
+// Since the queues themselves are private to their CPU, keeping
+// interrupts off while they are edited is all the locking they need.
 
 #include "process.h"
+#include "smp.h"
+#include "spinlock.h"
 #include "kernel.h"
 
-// Ready queue
-static process_t* ready_queue_head = 0;
-static process_t* ready_queue_tail = 0;
-
 // Scheduler statistics
-static unsigned long context_switches = 0;
+static atomic_t context_switches = ATOMIC_INIT(0);
+unsigned long cr3_loads = 0;  // bumped by switch_to_task
+static unsigned int switch_cycles = 0;      // running average, TSC cycles
+static unsigned int switch_cycles_min = 0;
+
+// Lowest set bit of a non-zero map
+static unsigned int first_level(unsigned int map) {
+    unsigned int level;
+    asm("bsf %1, %0" : "=r"(level) : "rm"(map));
+    return level;
+}
+
+// Level a process currently runs at: base priority moved by its bonus
+static unsigned int effective_level(process_t* process) {
+    int level = (int)process->priority - process->sched_bonus;
+    if (level < 0) level = 0;
+    if (level >= SCHED_LEVELS) level = SCHED_LEVELS - 1;
+    return (unsigned int)level;
+}
+
+static void runqueue_push(runqueue_t* rq, process_t* process) {
+    unsigned int level = effective_level(process);
+    process->run_level = level;
+    process->run_next = 0;
+    process->run_prev = rq->tails[level];
+    if (rq->tails[level]) rq->tails[level]->run_next = process;
+    else rq->heads[level] = process;
+    rq->tails[level] = process;
+    rq->bitmap |= 1u << level;
+}
+
+static void runqueue_unlink(runqueue_t* rq, process_t* process) {
+    unsigned int level = process->run_level;
+    if (process->run_prev) process->run_prev->run_next = process->run_next;
+    else rq->heads[level] = process->run_next;
+    if (process->run_next) process->run_next->run_prev = process->run_prev;
+    else rq->tails[level] = process->run_prev;
+    if (!rq->heads[level]) rq->bitmap &= ~(1u << level);
+    process->run_next = process->run_prev = 0;
+    process->run_level = SCHED_NOT_QUEUED;
+}
+
+void runqueue_init(runqueue_t* rq) {
+    for (int i = 0; i < SCHED_LEVELS; i++) {
+        rq->heads[i] = 0;
+        rq->tails[i] = 0;
+    }
+    rq->bitmap = 0;
+    rq->need_resched = 0;
+    rq->steals = 0;
+    deque_init(&rq->incoming);
+}
+
+// Offer a process for stealing; falls back to the queues when full
+static void runqueue_offer(runqueue_t* rq, process_t* process) {
+    process->run_level = SCHED_IN_DEQUE;
+    if (!deque_push(&rq->incoming, process)) runqueue_push(rq, process);
+}
+
+// A process taken out of a deque: queue it here, or free it if it was
+// terminated while waiting there
+static void runqueue_take(runqueue_t* rq, process_t* process) {
+    if (process->state == PROCESS_TERMINATED) {
+        process_bury(process);
+        return;
+    }
+    runqueue_push(rq, process);
+}
+
+// Move everything offered on this CPU into its own queues
+static void runqueue_drain(runqueue_t* rq) {
+    process_t* process;
+    while ((process = (process_t*)deque_pop(&rq->incoming))) {
+        runqueue_take(rq, process);
+    }
+}
+
+// Take a process another CPU has on offer, or 0
+static process_t* runqueue_steal(cpu_t* self) {
+    unsigned int count = smp_cpu_count();
+    for (unsigned int i = 1; i < count; i++) {
+        cpu_t* victim = smp_get_cpu((self->index + i) % count);
+        if (!victim->online) continue;
+        process_t* process = (process_t*)deque_steal(&victim->rq.incoming);
+        if (!process) continue;
+        if (process->state == PROCESS_TERMINATED) {
+            process_bury(process);
+            continue;
+        }
+        process->run_level = SCHED_NOT_QUEUED;
+        self->rq.steals++;
+        return process;
+    }
+    return 0;
+}
+
+// Nonzero if another CPU is running its idle process
+static int cpu_idle_elsewhere(cpu_t* self) {
+    unsigned int count = smp_cpu_count();
+    for (unsigned int i = 0; i < count; i++) {
+        cpu_t* cpu = smp_get_cpu(i);
+        if (cpu != self && cpu->online && cpu->current == cpu->idle) return 1;
+    }
+    return 0;
+}
+
+// Nonzero if another CPU has work on offer
+static int work_elsewhere(cpu_t* self) {
+    unsigned int count = smp_cpu_count();
+    for (unsigned int i = 0; i < count; i++) {
+        cpu_t* cpu = smp_get_cpu(i);
+        if (cpu != self && cpu->online && !deque_empty(&cpu->rq.incoming)) return 1;
+    }
+    return 0;
+}
 
 // Initialize scheduler
 void scheduler_init() {
     print_string("[OK] Initializing Scheduler...\n");
-    ready_queue_head = 0;
-    ready_queue_tail = 0;
-    context_switches = 0;
-    print_string("  Algorithm: Round-Robin\n");
+    runqueue_init(&this_cpu()->rq);
+    atomic_set(&context_switches, 0);
+    print_string("  Algorithm: O(1) priority, ");
+    print_dec(SCHED_LEVELS);
+    print_string(" levels, per-CPU queues\n");
     print_string("  Time quantum: 50ms (5 ticks)\n");
     print_string("[OK] Scheduler initialized\n");
 }
 
-// Add process to ready queue
+// Make a process runnable on this CPU, where idle CPUs may steal it
 void scheduler_add(process_t* process) {
-    if (!process) return;
-    
-    process->next = 0;
+    if (!process || process == process_get_idle()) return;
+    if (process->run_level != SCHED_NOT_QUEUED) return;
+
+    unsigned int flags = irq_save();
+    cpu_t* cpu = this_cpu();
     process->state = PROCESS_READY;
-    
-    if (ready_queue_tail) {
-        ready_queue_tail->next = process;
-        ready_queue_tail = process;
-    } else {
-        ready_queue_head = process;
-        ready_queue_tail = process;
+    runqueue_offer(&cpu->rq, process);
+
+    // Preempt the running process if this one is more urgent
+    if (cpu->current == cpu->idle ||
+        effective_level(process) < effective_level(cpu->current)) {
+        cpu->rq.need_resched = 1;
     }
+    irq_restore(flags);
 }
 
-// Remove process from ready queue
+// Take a process off this CPU's run queues. One waiting in a deque stays
+// there; whoever takes it out sees its new state.
 void scheduler_remove(process_t* process) {
-    if (!process) return;
-    
-    if (ready_queue_head == process) {
-        ready_queue_head = process->next;
-        if (ready_queue_tail == process) {
-            ready_queue_tail = 0;
-        }
-        return;
-    }
-    
-    process_t* current = ready_queue_head;
-    while (current && current->next != process) {
-        current = current->next;
-    }
-    
-    if (current) {
-        current->next = process->next;
-        if (ready_queue_tail == process) {
-            ready_queue_tail = current;
-        }
-    }
+    if (!process || process->run_level == SCHED_NOT_QUEUED) return;
+    if (process->run_level == SCHED_IN_DEQUE) return;
+    runqueue_unlink(&this_cpu()->rq, process);
 }
 
-// Get next process (round-robin)
+// Dequeue the most urgent ready process of this CPU, or 0 if none is ready
 process_t* scheduler_next() {
-    if (!ready_queue_head) {
-        return 0;  // No processes ready
-    }
-    
-    // Remove from front
-    process_t* next = ready_queue_head;
-    ready_queue_head = next->next;
-    
-    if (!ready_queue_head) {
-        ready_queue_tail = 0;
-    }
-    
-    // Add back to end if not terminated
-    if (next->state != PROCESS_TERMINATED) {
-        scheduler_add(next);
-    }
-    
+    runqueue_t* rq = &this_cpu()->rq;
+    if (!rq->bitmap) return 0;
+    process_t* next = rq->heads[first_level(rq->bitmap)];
+    runqueue_unlink(rq, next);
     return next;
 }
 
-// Schedule next process
-void schedule() {
-    process_t* current = process_get_current();
+// A process preempted between blocking and sleeping has not slept yet:
+// it still has to test its wait condition, which may already be true
+// with nobody left to wake it. Take it back from the blocked state
+// unless a waker on another CPU got there first and queued it itself.
+static int preempted_runnable(process_t* process) {
+    if (process->state == PROCESS_RUNNING) return 1;
+    process_state_t blocked = PROCESS_BLOCKED;
+    return __atomic_compare_exchange_n(&process->state, &blocked, PROCESS_RUNNING,
+                                       0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+// The queues are only touched with interrupts off
+static void schedule_common(int preempt) {
+    unsigned int flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    runqueue_t* rq = &cpu->rq;
+    process_t* current = cpu->current;
+    runqueue_drain(rq);
+
+    // The running process goes behind its peers unless it stopped being
+    // runnable (blocked, exited). If others are waiting here and a CPU is
+    // idle, it is offered for stealing instead.
+    int runnable = current != cpu->idle &&
+                   (preempt ? preempted_runnable(current) : current->state == PROCESS_RUNNING);
+    if (runnable) {
+        current->state = PROCESS_READY;
+        if (rq->bitmap && cpu_idle_elsewhere(cpu)) runqueue_offer(rq, current);
+        else runqueue_push(rq, current);
+    }
+
     process_t* next = scheduler_next();
-    
-    if (!next) return;  // No process to switch to
-    
+    if (!next) next = runqueue_steal(cpu);
+    if (!next) next = cpu->idle;
+    rq->need_resched = 0;
+    if (!next->ticks_left) next->ticks_left = next->quantum;
+
     if (next != current) {
-        context_switches++;
+        atomic_inc(&context_switches);
         process_switch(next);
+    } else {
+        current->state = PROCESS_RUNNING;
+    }
+    irq_restore(flags);
+}
+
+// Schedule next process. Called by anything that blocks or yields; a
+// process that blocked is left off the queues until it is woken.
+void schedule() {
+    schedule_common(0);
+}
+
+// Called from the timer IRQ when the running process used up its slice.
+// The process was interrupted, so it stays runnable even if it had
+// marked itself blocked.
+void schedule_preempt() {
+    schedule_common(1);
+}
+
+// Timer tick: charge the running process and end its slice when used up
+void scheduler_tick() {
+    cpu_t* cpu = this_cpu();
+    process_t* current = cpu->current;
+    if (!current) return;
+    if (current == cpu->idle) {
+        if (scheduler_runnable() || work_elsewhere(cpu)) cpu->rq.need_resched = 1;
+        return;
+    }
+
+    current->cpu_time++;
+    if (current->ticks_left && --current->ticks_left) return;
+
+    // A whole quantum spent computing: lose a level of bonus
+    if (current->sched_bonus > -SCHED_MAX_BONUS) current->sched_bonus--;
+    current->ticks_left = current->quantum;
+    if (scheduler_runnable()) cpu->rq.need_resched = 1;
+}
+
+// Nonzero when schedule() should be called at the next safe point
+int scheduler_need_resched() {
+    return this_cpu()->rq.need_resched;
+}
+
+// Nonzero if any process is waiting for this CPU
+int scheduler_runnable() {
+    runqueue_t* rq = &this_cpu()->rq;
+    return rq->bitmap != 0 || !deque_empty(&rq->incoming);
+}
+
+// Put a process to sleep until scheduler_wake. Blocking marks it as
+// interactive, so it gets a level of bonus.
+void scheduler_block(process_t* process) {
+    if (!process) return;
+    scheduler_remove(process);
+    process->state = PROCESS_BLOCKED;
+    if (process->sched_bonus < SCHED_MAX_BONUS) process->sched_bonus++;
+}
+
+// Wakers on different CPUs may race each other and the sleeper itself
+// (scheduler_unblock); only the one that moves the state on acts
+void scheduler_wake(process_t* process) {
+    process_state_t blocked = PROCESS_BLOCKED;
+    if (!process || !__atomic_compare_exchange_n(&process->state, &blocked, PROCESS_READY,
+                                                 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
     }
+    scheduler_add(process);
+}
+
+// Called by a process that blocked itself and found its wait already
+// over. Returns 1 if it may simply carry on, 0 if a wakeup got in first
+// and it is queued, in which case it must schedule().
+int scheduler_unblock(process_t* process) {
+    process_state_t blocked = PROCESS_BLOCKED;
+    return __atomic_compare_exchange_n(&process->state, &blocked, PROCESS_RUNNING,
+                                       0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
 }
 
 // Get context switch count
 unsigned long scheduler_get_switches() {
-    return context_switches;
+    return (unsigned long)atomic_read(&context_switches);
+}
+
+// Get number of switches that changed address space
+unsigned long scheduler_get_cr3_loads() {
+    return cr3_loads;
+}
+
+// Get number of processes CPUs took from each other
+unsigned long scheduler_get_steals() {
+    unsigned long steals = 0;
+    for (unsigned int i = 0; i < smp_cpu_count(); i++) {
+        steals += smp_get_cpu(i)->rq.steals;
+    }
+    return steals;
+}
+
+// Record the cost of one switch, as measured by process_switch. The
+// average is exponentially weighted (1/8 per sample) to stay in 32 bits.
+// CPUs update it without a lock; a lost sample does not matter here.
+void scheduler_account_switch(unsigned int cycles) {
+    if (!switch_cycles_min || cycles < switch_cycles_min) switch_cycles_min = cycles;
+    if (!switch_cycles) switch_cycles = cycles;
+    else switch_cycles = switch_cycles - (switch_cycles >> 3) + (cycles >> 3);
+}
+
+// Get average cycles per context switch
+unsigned int scheduler_get_switch_cycles() {
+    return switch_cycles;
+}
+
+// Get cheapest context switch seen, in cycles
+unsigned int scheduler_get_switch_cycles_min() {
+    return switch_cycles_min;
 }
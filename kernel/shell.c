@@ -5,7 +5,15 @@
 #include "kernel.h"
 #include "keyboard.h"
 #include "timer.h"
+#include "clock.h"
 #include "pmm.h"
+#include "slab.h"
+#include "heap.h"
+#include "memtag.h"
+#include "vmalloc.h"
+#include "process.h"
+#include "smp.h"
+#include "spinlock.h"
 #include "gui.h"
 #include "apps.h"
 
@@ -56,6 +64,9 @@ static void cmd_help(void) {
     print_colored("  version       ", COLOR_GREEN); print_colored("- Show OS version\n", COLOR_DEFAULT);
     print_colored("  uptime        ", COLOR_GREEN); print_colored("- Show system uptime\n", COLOR_DEFAULT);
     print_colored("  meminfo       ", COLOR_GREEN); print_colored("- Show memory info\n", COLOR_DEFAULT);
+    print_colored("  memstat       ", COLOR_GREEN); print_colored("- Memory use per subsystem\n", COLOR_DEFAULT);
+    print_colored("  ps            ", COLOR_GREEN); print_colored("- List processes\n", COLOR_DEFAULT);
+    print_colored("  locks         ", COLOR_GREEN); print_colored("- Spinlock contention\n", COLOR_DEFAULT);
     print_colored("  ls            ", COLOR_GREEN); print_colored("- List files (VFS)\n", COLOR_DEFAULT);
     print_colored("  cat [file]    ", COLOR_GREEN); print_colored("- Read a file\n", COLOR_DEFAULT);
     print_colored("  desktop       ", COLOR_CYAN);  print_colored("- Open graphical desktop\n", COLOR_DEFAULT);
@@ -81,16 +92,187 @@ static void cmd_uptime(void) {
     print_dec((unsigned int)(secs / 3600)); print_string("h ");
     print_dec((unsigned int)((secs % 3600) / 60)); print_string("m ");
     print_dec((unsigned int)(secs % 60)); print_string("s\n");
+    print_string("  Tickless idle: ");
+    print_string(timer_get_tickless() ? "on" : "off");
+    print_string(", ");
+    print_dec(timer_get_ticks_skipped());
+    print_string(" ticks skipped\n");
+    print_string("  Clock: ");
+    if (clock_get_tsc_khz()) {
+        print_string("TSC ");
+        print_dec(clock_get_tsc_khz() / 1000);
+        print_string(" MHz via ");
+    }
+    print_string(clock_get_source());
+    print_string("\n");
 }
 
 static void cmd_meminfo(void) {
-    unsigned int total    = pmm_get_total_memory() / 1024;
-    unsigned int used     = pmm_get_used_memory()  / 1024;
-    unsigned int free_mem = pmm_get_free_memory()  / 1024;
+    unsigned int total    = pmm_get_total_kb();
+    unsigned int used     = pmm_get_used_kb();
+    unsigned int free_mem = pmm_get_free_kb();
     print_colored("\n  Memory Information:\n", COLOR_CYAN);
     print_colored("  Total: ", COLOR_GREEN);  print_dec(total);    print_string(" KB\n");
     print_colored("  Used:  ", COLOR_YELLOW); print_dec(used);     print_string(" KB\n");
-    print_colored("  Free:  ", COLOR_GREEN);  print_dec(free_mem); print_string(" KB\n\n");
+    print_colored("  Free:  ", COLOR_GREEN);  print_dec(free_mem); print_string(" KB\n");
+    unsigned int kernel_kb = pmm_get_flag_pages(PMM_PAGE_KERNEL) * 4;
+    unsigned int user_kb   = pmm_get_flag_pages(PMM_PAGE_USER) * 4;
+    unsigned int cache_kb  = pmm_get_flag_pages(PMM_PAGE_PAGECACHE) * 4;
+    print_colored("  By type: ", COLOR_CYAN);
+    print_string("kernel "); print_dec(kernel_kb);
+    print_string(" KB, user "); print_dec(user_kb);
+    print_string(" KB, page cache "); print_dec(cache_kb);
+    print_string(" KB, reserved "); print_dec(used - kernel_kb - user_kb - cache_kb);
+    print_string(" KB\n");
+    print_string("           pinned "); print_dec(pmm_get_flag_pages(PMM_PAGE_PINNED) * 4);
+    print_string(" KB, dirty "); print_dec(pmm_get_flag_pages(PMM_PAGE_DIRTY) * 4);
+    print_string(" KB, LRU "); print_dec(pmm_get_lru_pages()); print_string(" pages\n");
+    unsigned int heap_total, heap_used, heap_free;
+    heap_get_stats(&heap_total, &heap_used, &heap_free);
+    print_colored("  Heap:  ", COLOR_GREEN);  print_dec(heap_used); print_string(" / ");
+    print_dec(heap_total); print_string(" bytes used, largest free ");
+    print_dec(heap_get_largest_free()); print_string(", fragmentation ");
+    print_dec(heap_get_fragmentation()); print_string("%\n");
+    unsigned int zero_pooled, zero_hits, zero_misses;
+    pmm_get_zero_stats(&zero_pooled, &zero_hits, &zero_misses);
+    print_colored("  Pre-zeroed: ", COLOR_GREEN); print_dec(zero_pooled);
+    print_string(" pages pooled, "); print_dec(zero_hits); print_string(" hits / ");
+    print_dec(zero_misses); print_string(" misses\n");
+    unsigned int vm_areas, vm_pages;
+    vmalloc_get_stats(&vm_areas, &vm_pages);
+    print_colored("  vmalloc: ", COLOR_GREEN); print_dec(vm_pages * 4);
+    print_string(" KB in "); print_dec(vm_areas); print_string(" areas\n");
+    print_colored("  Free blocks by order:\n  ", COLOR_CYAN);
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        print_dec(order); print_string(":");
+        print_dec(pmm_get_free_blocks(order)); print_string(" ");
+    }
+    unsigned int allocs, words;
+    pmm_get_scan_stats(&allocs, &words);
+    unsigned int avg_x100 = allocs ? (words * 100) / allocs : 0;
+    print_colored("\n  Page alloc scan: ", COLOR_CYAN);
+    print_dec(avg_x100 / 100); print_string(".");
+    if (avg_x100 % 100 < 10) print_string("0");
+    print_dec(avg_x100 % 100);
+    print_string(" words/alloc (");
+    print_dec(allocs); print_string(" allocs)\n");
+
+    const char *name;
+    unsigned int active, total_objs, slabs;
+    print_colored("  Slab caches:      active  total  slabs\n", COLOR_CYAN);
+    for (unsigned int i = 0; kmem_cache_get_stats(i, &name, &active, &total_objs, &slabs); i++) {
+        int len = 0;
+        print_string("    "); print_string(name);
+        while (name[len]) len++;
+        for (; len < 16; len++) print_string(" ");
+        print_dec(active);     print_string(" / ");
+        print_dec(total_objs); print_string("  ");
+        print_dec(slabs);      print_string("\n");
+    }
+    print_string("\n");
+}
+
+static void print_padded(const char *text, int width) {
+    int len = 0;
+    while (text[len]) len++;
+    print_string(text);
+    while (len++ < width) print_string(" ");
+}
+
+static void print_dec_padded(unsigned int num, int width) {
+    int len = 1;
+    for (unsigned int n = num; n >= 10; n /= 10) len++;
+    print_dec(num);
+    while (len++ < width) print_string(" ");
+}
+
+static void cmd_memstat(void) {
+    print_colored("\n  TAG       HEAP LIVE  HEAP PEAK  ALLOCS   PAGES  PEAK\n", COLOR_CYAN);
+    for (unsigned int tag = 0; tag < MEM_TAG_COUNT; tag++) {
+        unsigned int live, peak, allocs, pages, pages_peak;
+        heap_get_tag_stats(tag, &live, &peak, &allocs);
+        pmm_get_tag_stats(tag, &pages, &pages_peak);
+        print_string("  ");
+        print_padded(memtag_name(tag), 10);
+        print_dec_padded(live, 11);
+        print_dec_padded(peak, 11);
+        print_dec_padded(allocs, 9);
+        print_dec_padded(pages, 7);
+        print_dec(pages_peak); print_string("\n");
+    }
+
+    unsigned int counts[HEAP_HIST_BUCKETS];
+    heap_get_free_histogram(counts);
+    print_colored("  Heap free blocks by size:\n  ", COLOR_CYAN);
+    for (unsigned int i = 0; i < HEAP_HIST_BUCKETS; i++) {
+        unsigned int size = 16u << i;
+        if (size >= 1024) { print_dec(size / 1024); print_string("K"); }
+        else print_dec(size);
+        print_string(i + 1 < HEAP_HIST_BUCKETS ? ":" : "+:");
+        print_dec(counts[i]); print_string(" ");
+    }
+    print_string("\n  Largest free ");
+    print_dec(heap_get_largest_free()); print_string(" bytes, fragmentation ");
+    print_dec(heap_get_fragmentation()); print_string("%\n");
+}
+
+static void cmd_ps(void) {
+    static const char *state_names[] = { "ready", "running", "blocked", "done" };
+    print_colored("\n  PID  NAME                             STATE    PRI  CPU  FAULTS\n", COLOR_CYAN);
+    for (process_t *p = process_get_first(); p; p = p->all_next) {
+        print_string("  ");
+        print_dec(p->pid);
+        print_string(p->pid < 10 ? "    " : p->pid < 100 ? "   " : "  ");
+        print_padded(p->name, 33);
+        print_padded(state_names[p->state], 9);
+        print_dec(p->priority);
+        if (p->sched_bonus > 0) print_string("+");
+        else if (p->sched_bonus < 0) print_string("-");
+        else print_string(" ");
+        print_string(p->priority < 10 ? "   " : "  ");
+        print_dec_padded(p->cpu, 5);
+        print_dec(p->minor_faults);
+        print_string("\n");
+    }
+    print_string("  Context switches: ");
+    print_dec(scheduler_get_switches());
+    print_string(", CR3 loads: ");
+    print_dec(scheduler_get_cr3_loads());
+    print_string("\n");
+    print_string("  Switch cost: ");
+    print_dec(scheduler_get_switch_cycles());
+    print_string(" cycles avg, ");
+    print_dec(scheduler_get_switch_cycles_min());
+    print_string(" min\n");
+    print_string("  FPU loads: ");
+    print_dec(fpu_get_loads());
+    print_string(", saves: ");
+    print_dec(fpu_get_saves());
+    print_string("\n");
+    print_string("  CPUs online: ");
+    print_dec(smp_online_count());
+    print_string(", steals: ");
+    print_dec(scheduler_get_steals());
+    print_string("\n");
+}
+
+static void cmd_locks(void) {
+    spinlock_t *lock = spin_lock_get_first();
+    if (!lock) {
+        print_string("  Lock statistics off (build with LOCK_STATS=1)\n");
+        return;
+    }
+#ifdef CONFIG_LOCK_STATS
+    print_colored("\n  LOCK           ACQUIRED  CONTENDED  SPINS\n", COLOR_CYAN);
+    for (; lock; lock = lock->all_next) {
+        print_string("  ");
+        print_padded(lock->name, 15);
+        print_dec_padded(lock->acquired, 10);
+        print_dec_padded(lock->contended, 11);
+        print_dec(lock->spins);
+        print_string("\n");
+    }
+#endif
 }
 
 static void cmd_ls(void) {
@@ -120,6 +302,9 @@ void shell_execute(const char *cmd) {
     else if (str_eq(cmd, "version"))  cmd_version();
     else if (str_eq(cmd, "uptime"))   cmd_uptime();
     else if (str_eq(cmd, "meminfo"))  cmd_meminfo();
+    else if (str_eq(cmd, "memstat"))  cmd_memstat();
+    else if (str_eq(cmd, "ps"))       cmd_ps();
+    else if (str_eq(cmd, "locks"))    cmd_locks();
     else if (str_eq(cmd, "ls"))       cmd_ls();
     else if (str_eq(cmd, "desktop"))  gui_draw_desktop();
     else if (str_eq(cmd, "notepad"))  { app_notepad();     gui_draw_banner(); }
@@ -191,9 +376,6 @@ void shell_run(void) {
     print_prompt();
 
     while (1) {
-        char c = keyboard_getchar();
-        if (c)
-            shell_process_char(c);
-        asm volatile("hlt");
+        shell_process_char(keyboard_wait());
     }
 }
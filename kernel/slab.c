@@ -0,0 +1,231 @@
+// SUB OS - Slab Allocator
+// Copyright (c) 2025 SUB OS Project
+//
+// Each slab is one PMM page: a header, a free-index array and then the
+// objects. Because the header sits at the start of the page, freeing an
+// object finds its slab by masking the address, so alloc and free are O(1).
+// Free objects are tracked by index rather than by a link stored inside
+// the object, which keeps constructed state intact across free/alloc.
+//
+// Each cache has its own lock, so CPUs only contend when they allocate
+// the same kind of object.
+
+#include "slab.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "kernel.h"
+
+#define SLAB_PAGE_SIZE 4096
+#define SLAB_NO_FREE   0xFFFF
+
+typedef struct kmem_slab {
+    struct kmem_slab* next;
+    struct kmem_slab* prev;
+    kmem_cache_t* cache;
+    unsigned short in_use;
+    unsigned short free_head;
+    // unsigned short free_next[cache->objects_per_slab] follows
+} kmem_slab_t;
+
+struct kmem_cache {
+    spinlock_t lock;               // lists, slab create/destroy, counters
+    char name[KMEM_NAME_LEN];
+    unsigned int object_size;      // rounded up to align
+    unsigned int objects_offset;   // first object, from the slab start
+    unsigned int objects_per_slab;
+    void (*ctor)(void*);
+    kmem_slab_t* partial;          // some objects free
+    kmem_slab_t* full;             // no objects free
+    kmem_slab_t* empty;            // at most one cached empty slab
+    unsigned int active;
+    unsigned int total;
+    unsigned int slabs;
+};
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static unsigned int cache_count = 0;
+static spinlock_t cache_count_lock;     // hands out slots of caches[]
+
+static unsigned int align_up(unsigned int value, unsigned int align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static unsigned short* slab_free_next(kmem_slab_t* slab) {
+    return (unsigned short*)(slab + 1);
+}
+
+static void slab_list_push(kmem_slab_t** list, kmem_slab_t* slab) {
+    slab->prev = 0;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+static void slab_list_remove(kmem_slab_t** list, kmem_slab_t* slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *list = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = 0;
+}
+
+// Grab a page from the PMM and lay out a fresh slab in it
+static kmem_slab_t* slab_create(kmem_cache_t* cache) {
+    unsigned int page = pmm_alloc_page_tagged(MEM_TAG_SLAB);
+    if (!page) return 0;
+
+    kmem_slab_t* slab = (kmem_slab_t*)page;
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->free_head = 0;
+
+    unsigned short* free_next = slab_free_next(slab);
+    unsigned char* objects = (unsigned char*)page + cache->objects_offset;
+    for (unsigned int i = 0; i < cache->objects_per_slab; i++) {
+        free_next[i] = (i + 1 < cache->objects_per_slab) ?
+                       (unsigned short)(i + 1) : SLAB_NO_FREE;
+        if (cache->ctor) cache->ctor(objects + i * cache->object_size);
+    }
+
+    cache->total += cache->objects_per_slab;
+    cache->slabs++;
+    return slab;
+}
+
+static void slab_destroy(kmem_cache_t* cache, kmem_slab_t* slab) {
+    cache->total -= cache->objects_per_slab;
+    cache->slabs--;
+    pmm_free_page((unsigned int)slab);
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, unsigned int size,
+                                unsigned int align, void (*ctor)(void*)) {
+    if (cache_count >= KMEM_MAX_CACHES || size == 0) return 0;
+    if (align == 0) align = KMEM_CACHE_LINE;
+    if (align & (align - 1)) return 0;  // must be a power of two
+
+    unsigned int object_size = align_up(size, align);
+
+    // Fit as many objects as possible after the header and index array
+    unsigned int count = (SLAB_PAGE_SIZE - sizeof(kmem_slab_t)) / object_size;
+    while (count > 0 &&
+           align_up(sizeof(kmem_slab_t) + count * sizeof(unsigned short), align) +
+           count * object_size > SLAB_PAGE_SIZE) {
+        count--;
+    }
+    if (count == 0) {
+        print_string("[SLAB] Object too large for a slab: ");
+        print_string(name);
+        print_string("\n");
+        return 0;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&cache_count_lock);
+    if (cache_count >= KMEM_MAX_CACHES) {
+        spin_unlock_irqrestore(&cache_count_lock, flags);
+        return 0;
+    }
+    kmem_cache_t* cache = &caches[cache_count];
+    int i;
+    for (i = 0; name[i] && i < KMEM_NAME_LEN - 1; i++) {
+        cache->name[i] = name[i];
+    }
+    cache->name[i] = 0;
+    cache->object_size = object_size;
+    cache->objects_per_slab = count;
+    cache->objects_offset =
+        align_up(sizeof(kmem_slab_t) + count * sizeof(unsigned short), align);
+    cache->ctor = ctor;
+    cache->partial = 0;
+    cache->full = 0;
+    cache->empty = 0;
+    cache->active = 0;
+    cache->total = 0;
+    cache->slabs = 0;
+    spin_lock_init(&cache->lock, cache->name);
+    // Published last: stats readers walk up to cache_count unlocked
+    __atomic_store_n(&cache_count, cache_count + 1, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&cache_count_lock, flags);
+    return cache;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    if (!cache) return 0;
+
+    unsigned int flags = spin_lock_irqsave(&cache->lock);
+    kmem_slab_t* slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            cache->empty = 0;
+        } else {
+            slab = slab_create(cache);
+            if (!slab) {
+                spin_unlock_irqrestore(&cache->lock, flags);
+                return 0;
+            }
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+
+    unsigned int idx = slab->free_head;
+    slab->free_head = slab_free_next(slab)[idx];
+    slab->in_use++;
+    cache->active++;
+
+    if (slab->free_head == SLAB_NO_FREE) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    return (unsigned char*)slab + cache->objects_offset + idx * cache->object_size;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    if (!cache || !obj) return;
+
+    kmem_slab_t* slab = (kmem_slab_t*)((unsigned int)obj & ~(SLAB_PAGE_SIZE - 1));
+    if (slab->cache != cache) {
+        print_string("[SLAB] Object freed to wrong cache: ");
+        print_string(cache->name);
+        print_string("\n");
+        return;
+    }
+
+    unsigned int idx = ((unsigned int)obj - (unsigned int)slab - cache->objects_offset) /
+                       cache->object_size;
+    unsigned int flags = spin_lock_irqsave(&cache->lock);
+    int was_full = (slab->free_head == SLAB_NO_FREE);
+    slab_free_next(slab)[idx] = slab->free_head;
+    slab->free_head = (unsigned short)idx;
+    slab->in_use--;
+    cache->active--;
+
+    if (was_full) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    if (slab->in_use == 0) {
+        // Keep one empty slab around so alloc/free churn doesn't hit the PMM
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty) {
+            slab_destroy(cache, slab);
+        } else {
+            cache->empty = slab;
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+int kmem_cache_get_stats(unsigned int index, const char** name,
+                         unsigned int* active, unsigned int* total,
+                         unsigned int* slabs) {
+    if (index >= cache_count) return 0;
+    kmem_cache_t* cache = &caches[index];
+    *name = cache->name;
+    *active = cache->active;
+    *total = cache->total;
+    *slabs = cache->slabs;
+    return 1;
+}
@@ -0,0 +1,30 @@
+// SUB OS - Slab Allocator Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef SLAB_H
+#define SLAB_H
+
+// Objects are aligned to a cache line unless a larger alignment is asked for
+#define KMEM_CACHE_LINE  64
+#define KMEM_MAX_CACHES  16
+#define KMEM_NAME_LEN    16
+
+typedef struct kmem_cache kmem_cache_t;
+
+// Create a cache of fixed-size objects. align of 0 means KMEM_CACHE_LINE.
+// ctor (optional) runs once when an object is first carved out of a slab;
+// freed objects keep their constructed state.
+kmem_cache_t* kmem_cache_create(const char* name, unsigned int size,
+                                unsigned int align, void (*ctor)(void*));
+
+// Object allocation
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+// Statistics for the cache at index (0 .. KMEM_MAX_CACHES-1).
+// Returns 0 if no cache exists at that index.
+int kmem_cache_get_stats(unsigned int index, const char** name,
+                         unsigned int* active, unsigned int* total,
+                         unsigned int* slabs);
+
+#endif
@@ -0,0 +1,243 @@
+// SUB OS - Multiprocessor Support
+// Copyright (c) 2025 SUB OS Project
+//
+// CPUs are found in the ACPI MADT and started one at a time with the
+// INIT-SIPI-SIPI sequence. Each runs ap_boot.asm's trampoline into
+// ap_main on its own stack, which becomes that CPU's idle process.
+//
+// Per-CPU state lives in cpus[]; every CPU loads its own GDT whose GS
+// descriptor is based at its entry, so kernel code finds the running
+// CPU's data through GS without knowing which CPU it is on.
+
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "clock.h"
+#include "paging.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "kernel.h"
+
+#define AP_TRAMPOLINE   0x70000     // must match ap_boot.asm
+#define AP_START_US     100000      // time allowed for a CPU to come up
+
+extern char ap_trampoline[];
+extern char ap_trampoline_end[];
+extern unsigned int ap_param_cr3;
+extern unsigned int ap_param_cr4;
+extern unsigned int ap_param_stack;
+extern unsigned int ap_param_entry;
+extern unsigned int kernel_end;
+extern void idt_load();
+
+static cpu_t cpus[MAX_CPUS];
+static unsigned int cpu_count = 1;
+static volatile unsigned int ap_starting = 0;   // index of the CPU coming up
+
+// One shootdown at a time: the range (or an address space to leave),
+// and how many CPUs still owe a flush
+static spinlock_t tlb_lock;
+static volatile unsigned int tlb_address;
+static volatile unsigned int tlb_pages;
+static volatile unsigned int tlb_directory;
+static atomic_t tlb_waiting = ATOMIC_INIT(0);
+
+// Parameter in the copied trampoline, by its offset in the original
+static unsigned int* trampoline_param(unsigned int* param) {
+    return (unsigned int*)(AP_TRAMPOLINE + ((char*)param - ap_trampoline));
+}
+
+static void cpu_setup(cpu_t* cpu, unsigned int index) {
+    cpu->self = cpu;
+    cpu->index = index;
+    gdt_init_cpu(cpu->gdt, (unsigned int)&cpu->tss, sizeof(tss_t) - 1,
+                 (unsigned int)cpu, sizeof(cpu_t) - 1);
+}
+
+void smp_init_bsp() {
+    spin_lock_init(&tlb_lock, "tlb_shootdown");
+    cpus[0].online = 1;
+    cpu_setup(&cpus[0], 0);
+}
+
+cpu_t* this_cpu() {
+    cpu_t* cpu;
+    asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+cpu_t* smp_get_cpu(unsigned int index) {
+    return index < cpu_count ? &cpus[index] : 0;
+}
+
+unsigned int smp_cpu_count() {
+    return cpu_count;
+}
+
+unsigned int smp_online_count() {
+    unsigned int online = 0;
+    for (unsigned int i = 0; i < cpu_count; i++) {
+        if (cpus[i].online) online++;
+    }
+    return online;
+}
+
+static void tlb_request(unsigned int address, unsigned int pages, unsigned int directory) {
+    if (smp_online_count() < 2) return;
+    unsigned int flags = irq_save();
+    while (!spin_trylock(&tlb_lock)) {
+        smp_tlb_poll();
+        cpu_relax();
+    }
+
+    cpu_t* self = this_cpu();
+    tlb_address = address;
+    tlb_pages = pages;
+    tlb_directory = directory;
+    int targets = 0;
+    for (unsigned int i = 0; i < cpu_count; i++) {
+        if (&cpus[i] != self && cpus[i].online) targets++;
+    }
+    atomic_set(&tlb_waiting, targets);
+    for (unsigned int i = 0; i < cpu_count; i++) {
+        if (&cpus[i] != self && cpus[i].online) cpus[i].tlb_pending = 1;
+    }
+    smp_mb();
+    apic_send_ipi_others(APIC_TLB_VECTOR);
+    while (atomic_read(&tlb_waiting) > 0) cpu_relax();
+
+    spin_unlock(&tlb_lock);
+    irq_restore(flags);
+}
+
+void smp_tlb_shootdown(unsigned int address, unsigned int pages) {
+    tlb_request(address, pages, 0);
+}
+
+void smp_leave_directory(unsigned int directory) {
+    tlb_request(0, 0, directory);
+}
+
+void smp_tlb_poll() {
+    if (atomic_read(&tlb_waiting) <= 0) return;   // cheap test for spin loops
+    cpu_t* cpu = this_cpu();
+    if (!cpu->tlb_pending) return;
+    if (tlb_directory) paging_leave_directory(tlb_directory);
+    else paging_flush_tlb_local(tlb_address, tlb_pages);
+    cpu->tlb_pending = 0;
+    atomic_add_return(&tlb_waiting, -1);    // ordered after the flush
+}
+
+void smp_wake_cpu(unsigned int index) {
+    if (index >= cpu_count || !cpus[index].online || &cpus[index] == this_cpu()) return;
+    apic_send_ipi_to(cpus[index].apic_id, APIC_WAKE_VECTOR);
+}
+
+// First C code on an application processor, on the stack smp_init gave it
+static void ap_main() {
+    cpu_t* cpu = &cpus[ap_starting];
+    cpu_setup(cpu, ap_starting);
+    idt_load();
+    tss_init_cpu();
+    fpu_init_cpu();
+    apic_enable_cpu(0);
+    runqueue_init(&cpu->rq);
+
+    char name[] = "idle0";
+    name[4] = (char)('0' + cpu->index);
+    cpu->idle = process_create_idle(name);
+    cpu->current = cpu->idle;
+    cpu->online = 1;
+
+    apic_timer_start();
+    for (;;) process_idle();
+}
+
+static int smp_start_cpu(cpu_t* cpu) {
+    unsigned int stack = pmm_alloc_zeroed_page(PMM_PAGE_KERNEL | PMM_PAGE_TAG(MEM_TAG_PROCESS));
+    if (!stack) return 0;
+    *trampoline_param(&ap_param_stack) = stack + PAGE_SIZE;
+    ap_starting = cpu->index;
+
+    apic_send_init(cpu->apic_id);
+    udelay(10000);
+    apic_send_startup(cpu->apic_id, AP_TRAMPOLINE >> 12);
+    udelay(200);
+    if (!cpu->online) apic_send_startup(cpu->apic_id, AP_TRAMPOLINE >> 12);
+
+    for (unsigned int waited = 0; !cpu->online && waited < AP_START_US; waited += 100) {
+        udelay(100);
+    }
+    if (!cpu->online) {
+        pmm_free_page(stack);
+        return 0;
+    }
+    return 1;
+}
+
+void smp_init() {
+    print_string("[OK] Initializing SMP...\n");
+    acpi_madt_t* madt = (acpi_madt_t*)acpi_find_table("APIC");
+    if (!madt) {
+        print_string("  No MADT, running on one CPU\n");
+        return;
+    }
+    if (!apic_init(madt->lapic_address)) {
+        print_string("  No local APIC, running on one CPU\n");
+        return;
+    }
+    unsigned int boot_apic = apic_id();
+    cpus[0].apic_id = boot_apic;
+
+    // Every enabled local APIC but ours is a CPU to start
+    unsigned char* entry = (unsigned char*)(madt + 1);
+    unsigned char* end = (unsigned char*)madt + madt->header.length;
+    while (entry + sizeof(acpi_madt_entry_t) <= end && cpu_count < MAX_CPUS) {
+        acpi_madt_entry_t* header = (acpi_madt_entry_t*)entry;
+        if (header->length == 0) break;
+        if (header->type == MADT_LOCAL_APIC) {
+            acpi_madt_lapic_t* lapic = (acpi_madt_lapic_t*)entry;
+            if ((lapic->flags & MADT_LAPIC_ENABLED) && lapic->apic_id != boot_apic) {
+                cpus[cpu_count].apic_id = lapic->apic_id;
+                cpu_count++;
+            }
+        }
+        entry += header->length;
+    }
+    if (cpu_count == 1) {
+        print_string("  1 CPU\n");
+        return;
+    }
+    if ((unsigned int)&kernel_end > AP_TRAMPOLINE) {
+        print_string("  [WARN] Kernel overlaps the AP trampoline, not starting CPUs\n");
+        cpu_count = 1;
+        return;
+    }
+
+    // The trampoline enables paging with the kernel's directory and the
+    // boot CPU's paging features
+    unsigned int cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    char* dest = (char*)AP_TRAMPOLINE;
+    for (char* src = ap_trampoline; src < ap_trampoline_end; src++) *dest++ = *src;
+    *trampoline_param(&ap_param_cr3) = paging_get_kernel_directory();
+    *trampoline_param(&ap_param_cr4) = cr4;
+    *trampoline_param(&ap_param_entry) = (unsigned int)ap_main;
+
+    unsigned int started = 1;
+    for (unsigned int i = 1; i < cpu_count; i++) {
+        cpus[i].index = i;
+        if (smp_start_cpu(&cpus[i])) {
+            started++;
+        } else {
+            print_string("  [WARN] CPU with APIC ID ");
+            print_dec(cpus[i].apic_id);
+            print_string(" did not start\n");
+        }
+    }
+    print_string("  CPUs online: ");
+    print_dec(started);
+    print_string(" of ");
+    print_dec(cpu_count);
+    print_string("\n");
+}
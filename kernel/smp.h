@@ -0,0 +1,63 @@
+// SUB OS - Multiprocessor Support Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef SMP_H
+#define SMP_H
+
+#include "process.h"
+#include "tss.h"
+#include "gdt.h"
+
+#define MAX_CPUS 8
+
+// Per-CPU data. GS is based here on every CPU, so this_cpu() is a
+// single load of the self pointer.
+typedef struct cpu {
+    struct cpu* self;               // must stay first (GS:0)
+    unsigned int index;
+    unsigned int apic_id;
+    volatile int online;
+    process_t* current;
+    process_t* idle;
+    process_t* zombies;             // exited here, freed after the next switch
+    process_t* switch_prev;         // process being switched away from
+    unsigned int switch_stamp;      // TSC when that switch began
+    process_t* fpu_owner;           // whose state the FPU registers hold
+    int fpu_live;                   // CR0.TS clear: current owns the FPU
+    volatile int tlb_pending;       // shootdown requested, not yet done
+    runqueue_t rq;
+    tss_t tss;
+    unsigned long long gdt[GDT_ENTRIES];
+} cpu_t;
+
+// Set up CPU 0's GDT, TSS descriptor and GS. Must run before anything
+// that can take an interrupt or call this_cpu().
+void smp_init_bsp();
+
+// Find the other CPUs in the ACPI MADT and start them
+void smp_init();
+
+cpu_t* this_cpu();
+cpu_t* smp_get_cpu(unsigned int index);
+unsigned int smp_cpu_count();
+unsigned int smp_online_count();
+
+// Flush a range of kernel mappings from every other CPU's TLB and wait
+// until they all have. Call after changing or removing the mappings and
+// before their frames can be reused.
+void smp_tlb_shootdown(unsigned int address, unsigned int pages);
+
+// Make every other CPU that has directory loaded switch to the kernel's,
+// and wait until they all have. Call before freeing an address space a
+// kernel thread elsewhere may still be borrowing.
+void smp_leave_directory(unsigned int directory);
+
+// Carry out a shootdown addressed to this CPU, if any. The IPI handler
+// runs it; so does any loop that spins with interrupts off, since the
+// CPU it waits for may itself be waiting for this one.
+void smp_tlb_poll();
+
+// Interrupt the CPU at index out of a hlt (no-op for the calling CPU)
+void smp_wake_cpu(unsigned int index);
+
+#endif
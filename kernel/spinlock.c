@@ -0,0 +1,151 @@
+// SUB OS - Spinlocks
+// Copyright (c) 2025 SUB OS Project
+//
+// Ticket spinlocks and sequence locks. A lock protects one subsystem's
+// data (heap, PMM, keyboard ring, ...) rather than the whole kernel, so
+// CPUs only wait for each other when they use the same thing.
+//
+// Built with LOCK_STATS=1, every lock counts acquisitions and waits and
+// is listed by the shell's locks command.
+
+#include "spinlock.h"
+#include "smp.h"
+
+#ifdef CONFIG_LOCK_STATS
+static spinlock_t* lock_list = 0;
+static spinlock_t registry_lock;
+#endif
+
+// Named locks are listed in the statistics; short-lived ones (inside
+// objects that get freed) should pass 0
+void spin_lock_init(spinlock_t* lock, const char* name) {
+    lock->next = 0;
+    lock->owner = 0;
+    lock->name = name;
+#ifdef CONFIG_LOCK_STATS
+    lock->acquired = 0;
+    lock->contended = 0;
+    lock->spins = 0;
+    lock->all_next = 0;
+    if (!name) return;
+    unsigned int flags = spin_lock_irqsave(&registry_lock);
+    lock->all_next = lock_list;
+    lock_list = lock;
+    spin_unlock_irqrestore(&registry_lock, flags);
+#endif
+}
+
+void spin_lock(spinlock_t* lock) {
+    unsigned int ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    unsigned int spins = 0;
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        // The holder may be waiting for this CPU to flush its TLB
+        smp_tlb_poll();
+        cpu_relax();
+        spins++;
+    }
+#ifdef CONFIG_LOCK_STATS
+    // Held now, so plain increments are safe
+    lock->acquired++;
+    if (spins) {
+        lock->contended++;
+        lock->spins += spins;
+    }
+#else
+    (void)spins;
+#endif
+}
+
+// Take the lock only if nobody holds or waits for it. Returns nonzero
+// on success.
+int spin_trylock(spinlock_t* lock) {
+    unsigned int owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    unsigned int expected = owner;
+    if (!__atomic_compare_exchange_n(&lock->next, &expected, owner + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+#ifdef CONFIG_LOCK_STATS
+    lock->acquired++;
+#endif
+    return 1;
+}
+
+void spin_unlock(spinlock_t* lock) {
+    // Only the holder writes owner
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+int spin_is_locked(spinlock_t* lock) {
+    return __atomic_load_n(&lock->next, __ATOMIC_RELAXED) !=
+           __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+}
+
+unsigned int irq_save() {
+    unsigned int flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+void irq_restore(unsigned int flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
+
+int irq_enabled() {
+    unsigned int flags;
+    asm volatile("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+unsigned int spin_lock_irqsave(spinlock_t* lock) {
+    unsigned int flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t* lock, unsigned int flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+void seqlock_init(seqlock_t* seqlock, const char* name) {
+    seqlock->sequence = 0;
+    spin_lock_init(&seqlock->lock, name);
+}
+
+// Writers must not be interrupted by a reader on their own CPU (it would
+// spin on the odd sequence forever): call with interrupts off
+void write_seqlock(seqlock_t* seqlock) {
+    spin_lock(&seqlock->lock);
+    __atomic_store_n(&seqlock->sequence, seqlock->sequence + 1, __ATOMIC_RELAXED);
+    smp_wmb();
+}
+
+void write_sequnlock(seqlock_t* seqlock) {
+    smp_wmb();
+    __atomic_store_n(&seqlock->sequence, seqlock->sequence + 1, __ATOMIC_RELEASE);
+    spin_unlock(&seqlock->lock);
+}
+
+// Start of a read section: waits out a write in progress
+unsigned int read_seqbegin(seqlock_t* seqlock) {
+    unsigned int start;
+    while ((start = __atomic_load_n(&seqlock->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_relax();
+    }
+    return start;
+}
+
+// Nonzero if a write overlapped the read section begun at start
+int read_seqretry(seqlock_t* seqlock, unsigned int start) {
+    smp_rmb();
+    return __atomic_load_n(&seqlock->sequence, __ATOMIC_RELAXED) != start;
+}
+
+spinlock_t* spin_lock_get_first() {
+#ifdef CONFIG_LOCK_STATS
+    return lock_list;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,54 @@
+// SUB OS - Spinlocks
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "atomic.h"
+
+// Ticket lock: a CPU takes the next ticket and waits until owner reaches
+// it, so waiters get the lock in arrival order. All zeroes is unlocked.
+typedef struct spinlock {
+    volatile unsigned int next;     // ticket handed to the next arrival
+    volatile unsigned int owner;    // ticket now holding the lock
+    const char* name;
+#ifdef CONFIG_LOCK_STATS
+    unsigned long acquired;         // times taken
+    unsigned long contended;        // times a CPU had to wait
+    unsigned long spins;            // wait loop iterations, all waits
+    struct spinlock* all_next;      // registered locks
+#endif
+} spinlock_t;
+
+// Sequence lock: readers never block the writer; they retry if a write
+// ran while they read. sequence is odd while a write is in progress.
+typedef struct {
+    volatile unsigned int sequence;
+    spinlock_t lock;                // serializes writers
+} seqlock_t;
+
+void spin_lock_init(spinlock_t* lock, const char* name);
+void spin_lock(spinlock_t* lock);
+int spin_trylock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+int spin_is_locked(spinlock_t* lock);
+
+// Interrupt flag save/restore. Locks also taken by interrupt handlers
+// must be held with interrupts off, or an IRQ on the holder's CPU spins
+// on it forever.
+unsigned int irq_save();
+void irq_restore(unsigned int flags);
+int irq_enabled();
+unsigned int spin_lock_irqsave(spinlock_t* lock);
+void spin_unlock_irqrestore(spinlock_t* lock, unsigned int flags);
+
+void seqlock_init(seqlock_t* seqlock, const char* name);
+void write_seqlock(seqlock_t* seqlock);
+void write_sequnlock(seqlock_t* seqlock);
+unsigned int read_seqbegin(seqlock_t* seqlock);
+int read_seqretry(seqlock_t* seqlock, unsigned int start);
+
+// Registered locks, for statistics (LOCK_STATS builds only, else 0)
+spinlock_t* spin_lock_get_first();
+
+#endif
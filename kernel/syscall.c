@@ -4,6 +4,7 @@
 #include "syscall.h"
 #include "process.h"
 #include "timer.h"
+#include "futex.h"
 #include "kernel.h"
 
 // System call table
@@ -28,17 +29,22 @@ void syscall_init() {
     syscall_table[SYS_GETPID] = (syscall_fn_t)sys_getpid;
     syscall_table[SYS_SLEEP] = (syscall_fn_t)sys_sleep;
     syscall_table[SYS_YIELD] = (syscall_fn_t)sys_yield;
+    syscall_table[SYS_FUTEX] = sys_futex;
     
-    print_string("  Registered 9 system calls\n");
+    print_string("  Registered 8 system calls\n");
     print_string("  Interface: INT 0x80\n");
     print_string("[OK] System Calls initialized\n");
 }
 
 // System call dispatcher (called from interrupt handler)
-int syscall_handler(int syscall_num, int arg1, int arg2, int arg3) {
+int syscall_handler(int syscall_num, int arg1, int arg2, int arg3, syscall_frame_t* frame) {
     if (syscall_num < 0 || syscall_num >= 256) {
         return SYSCALL_ERROR;
     }
+    // Kept per process: with several CPUs (and sleeping calls) there is
+    // more than one call in progress
+    process_t* current = process_get_current();
+    if (current) current->syscall_frame = frame;
     
     syscall_fn_t handler = syscall_table[syscall_num];
     if (!handler) {
@@ -69,10 +75,16 @@ int sys_exit(int status) {
     return SYSCALL_SUCCESS;
 }
 
-// sys_fork - Create child process (stub for now)
+// sys_fork - Create child process sharing the parent's pages copy-on-write
 int sys_fork() {
-    print_string("[SYSCALL] fork() not yet implemented\n");
-    return SYSCALL_ERROR;
+    process_t* current = process_get_current();
+    if (!current || !current->page_directory || !current->syscall_frame) {
+        return SYSCALL_ERROR;
+    }
+
+    process_t* child = process_fork(current, (unsigned int*)current->syscall_frame,
+                                    sizeof(syscall_frame_t) / sizeof(unsigned int));
+    return child ? (int)child->pid : SYSCALL_ERROR;
 }
 
 // sys_read - Read from file descriptor (stub)
@@ -114,3 +126,17 @@ int sys_yield() {
     schedule();
     return SYSCALL_SUCCESS;
 }
+
+// sys_futex - Wait on or wake a user-space word (see futex.c). Takes the
+// table's own signature, so it is registered without a cast.
+int sys_futex(int addr, int op, int val) {
+    unsigned int* uaddr = (unsigned int*)addr;
+    if (op == FUTEX_WAIT) {
+        return futex_wait(uaddr, (unsigned int)val) < 0 ? SYSCALL_ERROR : SYSCALL_SUCCESS;
+    }
+    if (op == FUTEX_WAKE) {
+        int woken = futex_wake(uaddr, val);
+        return woken < 0 ? SYSCALL_ERROR : woken;
+    }
+    return SYSCALL_ERROR;
+}
@@ -14,11 +14,19 @@
 #define SYS_GETPID  6
 #define SYS_SLEEP   7
 #define SYS_YIELD   8
+#define SYS_FUTEX   9   // ebx = address, ecx = FUTEX_WAIT/WAKE, edx = value/count
 
 // System call return values
 #define SYSCALL_SUCCESS  0
 #define SYSCALL_ERROR   -1
 
+// Stack layout built by syscall_entry: saved registers, then the
+// interrupt frame pushed by the CPU on the way in from ring 3
+typedef struct {
+    unsigned int ebp, edi, esi, edx, ecx, ebx;
+    unsigned int eip, cs, eflags, useresp, ss;
+} syscall_frame_t;
+
 // Initialize system calls
 void syscall_init();
 
@@ -30,8 +38,9 @@ int sys_write(int fd, const void* buf, unsigned int count);
 int sys_getpid();
 int sys_sleep(unsigned int ms);
 int sys_yield();
+int sys_futex(int addr, int op, int val);  // (unsigned int* uaddr, op, val)
 
 // System call dispatcher
-int syscall_handler(int syscall_num, int arg1, int arg2, int arg3);
+int syscall_handler(int syscall_num, int arg1, int arg2, int arg3, syscall_frame_t* frame);
 
 #endif
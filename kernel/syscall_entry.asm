@@ -3,8 +3,12 @@
 ; SUB OS - User/Kernel interface
 
 global syscall_entry
+global fork_return
 extern syscall_handler
 
+PERCPU_SEL equ 0x30     ; gdt.h GDT_PERCPU
+USER_DATA_SEL equ 0x23
+
 syscall_entry:
     ; Save all registers
     push ebx
@@ -17,12 +21,18 @@ syscall_entry:
     ; Call C handler
     ; EAX = syscall number
     ; EBX = arg1, ECX = arg2, EDX = arg3
+    mov esi, esp    ; saved registers + iret frame (syscall_frame_t)
+    push gs         ; user GS; the kernel's reaches this CPU's data
+    mov bp, PERCPU_SEL
+    mov gs, bp
+    push esi    ; frame
     push edx    ; arg3
     push ecx    ; arg2
     push ebx    ; arg1
     push eax    ; syscall number
     call syscall_handler
-    add esp, 16 ; Clean up stack
+    add esp, 20 ; Clean up stack
+    pop gs
     
     ; Restore registers
     pop ebp
@@ -34,3 +44,22 @@ syscall_entry:
     
     ; Return value in EAX
     iret
+
+; First code a forked child runs: its kernel stack holds a copy of the
+; parent's syscall frame, so unwind it and return 0 from fork(). It may
+; be switched in from an IRQ, which loads kernel data selectors, and the
+; iret to ring 3 would null those: give it user ones, as enter_usermode.
+fork_return:
+    mov ax, USER_DATA_SEL
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    pop ebp
+    pop edi
+    pop esi
+    pop edx
+    pop ecx
+    pop ebx
+    xor eax, eax
+    iret
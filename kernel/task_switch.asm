@@ -3,57 +3,63 @@
 ; SUB OS - Low-level context switching
 
 global switch_to_task
+global task_start
 global read_eip
+extern cr3_loads
+extern process_finish_switch
+
+; Offsets into registers_t
+%define REGS_ESP 24
+%define REGS_CR3 40
 
 ; Read current instruction pointer
 read_eip:
     pop eax
     jmp eax
 
-; Switch to another task
-; Parameters: EAX = pointer to current process, EBX = pointer to next process
+; void switch_to_task(registers_t* prev, registers_t* next)
+; Only the callee-saved registers and EFLAGS need to survive a call, so
+; they are pushed on the outgoing kernel stack and the stack pointer is
+; all that goes into prev. The incoming stack holds the same frame (built
+; by process_create & co. for a task that has never run), so popping it
+; and returning resumes next where it last called switch_to_task.
 switch_to_task:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    pushfd
     cli
-    
-    mov ecx, [esp+4]   ; ECX = current process
-    mov edx, [esp+8]   ; EDX = next process
-    
-    ; Check if current process exists
+
+    mov eax, [esp+24]  ; EAX = prev
+    mov edx, [esp+28]  ; EDX = next
+
+    mov [eax+REGS_ESP], esp
+    mov esp, [edx+REGS_ESP]
+
+    ; Load page directory. CR3 of 0 (kernel thread) borrows the current
+    ; one, and reloading the directory already in use would only flush
+    ; the TLB for nothing.
+    mov ecx, [edx+REGS_CR3]
     test ecx, ecx
-    jz .load_context
-    
-    ; Save current process context
-    mov [ecx+4], ebx   ; Save EBX
-    mov [ecx+8], ecx   ; Save ECX (we modify it)
-    mov [ecx+12], edx  ; Save EDX (we modify it)
-    
-    mov ebx, [esp]     ; Get return address
-    mov [ecx+32], ebx  ; Save EIP
-    
-    mov [ecx+28], esp  ; Save ESP
-    mov [ecx+30], ebp  ; Save EBP
-    
-    pushfd
+    jz .same_space
+    mov eax, cr3
+    cmp ecx, eax
+    je .same_space
+    mov cr3, ecx       ; Switch page directory
+    lock inc dword [cr3_loads]
+.same_space:
+
+    popfd
+    pop edi
+    pop esi
     pop ebx
-    mov [ecx+36], ebx  ; Save EFLAGS
-    
-.load_context:
-    ; Load next process context
-    mov eax, [edx+0]   ; Restore EAX
-    mov ebx, [edx+4]   ; Restore EBX
-    mov ecx, [edx+8]   ; Restore ECX
-    
-    mov esp, [edx+28]  ; Restore ESP
-    mov ebp, [edx+30]  ; Restore EBP
-    
-    mov esi, [edx+36]  ; Get EFLAGS
-    push esi
-    popfd              ; Restore EFLAGS
-    
-    ; Load page directory
-    mov esi, [edx+40]  ; Get CR3
-    mov cr3, esi       ; Switch page directory
-    
-    ; Jump to saved EIP
-    mov esi, [edx+32]
-    jmp esi
+    pop ebp
+    ret
+
+; First "return" of a task that has never run: finish the switch as
+; process_switch would have, then return into the task's real entry
+; (pushed above this address by push_switch_frame)
+task_start:
+    call process_finish_switch
+    ret
@@ -1,28 +1,315 @@
 // SUB OS - Timer Driver
 // Copyright (c) 2025 SUB OS Project
+//
+// Kernel timers live on a hashed hierarchical timing wheel: four levels
+// of 64 slots, each level covering 64 times the span of the one below.
+// A timer is hashed into a slot by its expiry tick, so arming and
+// cancelling are O(1). Each tick runs one level 0 slot; when level 0
+// wraps, the next level's current slot is cascaded down, which spreads
+// the cost of far-off timers over the ticks they wait through.
+//
+// When the idle process has nothing to run, the PIT is switched to
+// one-shot mode up to the next wheel deadline (tickless idle). The ticks
+// slept through are replayed when the CPU wakes, so timer_ticks, the
+// wheel and timers all stay on time.
+//
+// Only the boot CPU takes the PIT interrupt, but timers are armed from
+// every CPU, so the wheel has a lock. A timer armed elsewhere that falls
+// due inside a tickless stretch wakes the boot CPU with an IPI, which
+// ends the stretch early. The 64-bit tick count is read
+// under a seqlock: a reader on another CPU could otherwise see one half
+// from before an increment and the other from after.
 
 #include "timer.h"
 #include "kernel.h"
+#include "process.h"
+#include "spinlock.h"
+#include "smp.h"
 
-// Timer frequency (100 Hz = 100 ticks per second)
-#define TIMER_FREQUENCY 100
 #define PIT_CHANNEL_0 0x40
 #define PIT_COMMAND 0x43
+#define PIT_FREQUENCY 1193182
+#define PIT_DIVISOR (PIT_FREQUENCY / TIMER_FREQUENCY)
+#define PIT_MAX_COUNT 0xFFFF
+
+// Timing wheel geometry: 4 x 6 bits covers 2^24 ticks (~46 hours)
+#define WHEEL_BITS    6
+#define WHEEL_SIZE    (1 << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS  4
+#define WHEEL_SPAN    (1UL << (WHEEL_BITS * WHEEL_LEVELS))
 
 // Tick counter
-static unsigned long timer_ticks = 0;
+static unsigned long long timer_ticks = 0;
+static seqlock_t ticks_lock;
+
+// Timing wheel and the next tick it will run
+static ktimer_t* wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static unsigned long wheel_time = 0;
+static spinlock_t wheel_lock;
+
+// Tickless idle state
+static int tickless_enabled = 1;
+static unsigned int oneshot_ticks = 0;   // ticks the one-shot covers, 0 if periodic
+static unsigned long oneshot_last = 0;   // wheel tick its IRQ runs up to
+static unsigned int oneshot_count = 0;   // PIT count it was programmed with
+static unsigned int oneshot_first = 0;   // counts until the first tick in it
+static unsigned int pit_residue = 0;     // counts of a partial tick cut short
+static unsigned long ticks_skipped = 0;  // timer IRQs saved by tickless idle
+
+// Hash a timer into the slot of the lowest level whose span reaches it
+static void wheel_insert(ktimer_t* timer) {
+    unsigned long expires = timer->expires;
+    long delta = (long)(expires - wheel_time);
+    ktimer_t** bucket;
+
+    if (delta < 0) {
+        // Already due: run on the next tick
+        bucket = &wheel[0][wheel_time & WHEEL_MASK];
+    } else {
+        if ((unsigned long)delta >= WHEEL_SPAN) {
+            expires = wheel_time + WHEEL_SPAN - 1;
+            timer->expires = expires;
+        }
+        unsigned int level = 0;
+        while (level < WHEEL_LEVELS - 1 &&
+               (unsigned long)delta >= (1UL << (WHEEL_BITS * (level + 1)))) {
+            level++;
+        }
+        bucket = &wheel[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    }
+
+    timer->bucket = bucket;
+    timer->prev = 0;
+    timer->next = *bucket;
+    if (*bucket) (*bucket)->prev = timer;
+    *bucket = timer;
+}
+
+static void wheel_unlink(ktimer_t* timer) {
+    if (timer->prev) timer->prev->next = timer->next;
+    else *timer->bucket = timer->next;
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->next = timer->prev = 0;
+    timer->bucket = 0;
+}
+
+// Re-hash every timer of one upper-level slot into the levels below
+static void wheel_cascade(unsigned int level) {
+    ktimer_t** bucket = &wheel[level][(wheel_time >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    ktimer_t* timer = *bucket;
+    *bucket = 0;
+    while (timer) {
+        ktimer_t* next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+}
+
+// Run the timers due at wheel_time, then step it. Called with
+// interrupts off.
+static void wheel_advance() {
+    spin_lock(&wheel_lock);
+    unsigned int index = wheel_time & WHEEL_MASK;
+    for (unsigned int level = 1; index == 0 && level < WHEEL_LEVELS; level++) {
+        wheel_cascade(level);
+        index = (wheel_time >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    }
+
+    ktimer_t** bucket = &wheel[0][wheel_time & WHEEL_MASK];
+    while (*bucket) {
+        ktimer_t* timer = *bucket;
+        timer_fn_t fn = timer->fn;
+        void* data = timer->data;
+        wheel_unlink(timer);
+        // Once unlinked the timer may be reused or gone; fn runs unlocked
+        // so it can re-arm timers
+        spin_unlock(&wheel_lock);
+        fn(data);
+        spin_lock(&wheel_lock);
+    }
+    wheel_time++;
+    spin_unlock(&wheel_lock);
+}
+
+void timer_add(ktimer_t* timer, unsigned long ticks, timer_fn_t fn, void* data) {
+    unsigned int flags = spin_lock_irqsave(&wheel_lock);
+    if (timer->bucket) wheel_unlink(timer);
+    timer->fn = fn;
+    timer->data = data;
+    // wheel_time is the tick the next IRQ runs, so one tick from now
+    timer->expires = wheel_time + ticks - 1;
+    wheel_insert(timer);
+    // During a tickless stretch the wheel only runs when it ends
+    int late = oneshot_ticks && (long)(timer->expires - oneshot_last) < 0;
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    if (late) smp_wake_cpu(0);
+}
+
+int timer_cancel(ktimer_t* timer) {
+    unsigned int flags = spin_lock_irqsave(&wheel_lock);
+    int pending = timer->bucket != 0;
+    if (pending) wheel_unlink(timer);
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    return pending;
+}
+
+int timer_pending(ktimer_t* timer) {
+    return timer->bucket != 0;
+}
+
+// Number of ticks that can pass, up to max, before the wheel needs to run:
+// the last of them may have timers due or a cascade, none before it may
+static unsigned int wheel_idle_ticks(unsigned int max) {
+    unsigned int ticks = 1;
+    while (ticks < max) {
+        unsigned long time = wheel_time + ticks - 1;
+        if (!(time & WHEEL_MASK) || wheel[0][time & WHEEL_MASK]) break;
+        ticks++;
+    }
+    return ticks;
+}
+
+static void pit_set_periodic() {
+    outb(PIT_COMMAND, 0x36);  // Channel 0, lobyte/hibyte, rate generator
+    outb(PIT_CHANNEL_0, PIT_DIVISOR & 0xFF);
+    outb(PIT_CHANNEL_0, (PIT_DIVISOR >> 8) & 0xFF);
+}
+
+static void pit_set_oneshot(unsigned int count) {
+    outb(PIT_COMMAND, 0x30);  // Channel 0, lobyte/hibyte, interrupt on terminal count
+    outb(PIT_CHANNEL_0, count & 0xFF);
+    outb(PIT_CHANNEL_0, (count >> 8) & 0xFF);
+}
+
+static unsigned int pit_read_count() {
+    outb(PIT_COMMAND, 0x00);  // Latch channel 0
+    unsigned int low = inb(PIT_CHANNEL_0);
+    unsigned int high = inb(PIT_CHANNEL_0);
+    return (high << 8) | low;
+}
+
+// Nonzero once a one-shot count has reached zero (its IRQ is pending)
+static int pit_oneshot_expired() {
+    outb(PIT_COMMAND, 0xE2);  // Read-back: latch status of channel 0
+    return inb(PIT_CHANNEL_0) & 0x80;  // OUT pin
+}
+
+// Replay ticks that passed without a timer IRQ
+static void timer_catch_up(unsigned int ticks) {
+    while (ticks--) {
+        write_seqlock(&ticks_lock);
+        timer_ticks++;
+        write_sequnlock(&ticks_lock);
+        wheel_advance();
+    }
+}
+
+// Called by the idle process with interrupts off and nothing runnable:
+// stretch the current tick up to the next wheel deadline. Returns
+// nonzero if the PIT was switched to one-shot mode.
+int timer_idle_enter() {
+    if (!tickless_enabled || oneshot_ticks) return 0;
+
+    // Keep the tick phase: the one-shot first runs out the current
+    // period, then whole periods after it
+    unsigned int first = pit_read_count();
+    if (first == 0 || first > PIT_DIVISOR) first = PIT_DIVISOR;
+    spin_lock(&wheel_lock);
+    unsigned int ticks = wheel_idle_ticks(1 + (PIT_MAX_COUNT - first) / PIT_DIVISOR);
+    if (ticks <= 1) {
+        spin_unlock(&wheel_lock);
+        return 0;
+    }
+    // Published under the lock, so timer_add either sees the stretch or
+    // was seen by wheel_idle_ticks
+    oneshot_ticks = ticks;
+    oneshot_last = wheel_time + ticks - 1;
+    spin_unlock(&wheel_lock);
+
+    oneshot_first = first;
+    oneshot_count = first + (ticks - 1) * PIT_DIVISOR;
+    pit_set_oneshot(oneshot_count);
+    return 1;
+}
+
+// Called by the idle process, interrupts off, after it wakes up. If
+// something other than the one-shot woke it, account for the ticks that
+// did pass and go back to periodic mode.
+void timer_idle_exit() {
+    if (!oneshot_ticks || pit_oneshot_expired()) return;  // the IRQ catches up
+
+    unsigned int elapsed = oneshot_count - pit_read_count();
+    unsigned int ticks = 0;
+    if (elapsed >= oneshot_first) {
+        ticks = 1 + (elapsed - oneshot_first) / PIT_DIVISOR;
+        elapsed = (elapsed - oneshot_first) % PIT_DIVISOR;
+    } else {
+        elapsed += PIT_DIVISOR - oneshot_first;
+    }
+    // Restarting the period drops the part of a tick already spent;
+    // bank it so the clock does not drift behind over many wakeups
+    pit_residue += elapsed;
+    if (pit_residue >= PIT_DIVISOR) {
+        pit_residue -= PIT_DIVISOR;
+        ticks++;
+    }
+
+    spin_lock(&wheel_lock);
+    oneshot_ticks = 0;
+    spin_unlock(&wheel_lock);
+    pit_set_periodic();
+    ticks_skipped += ticks;
+    timer_catch_up(ticks);
+}
+
+// Enable or disable tickless idle
+void timer_set_tickless(int enabled) {
+    tickless_enabled = enabled;
+}
+
+int timer_get_tickless() {
+    return tickless_enabled;
+}
+
+// Get number of timer IRQs tickless idle avoided
+unsigned long timer_get_ticks_skipped() {
+    return ticks_skipped;
+}
 
 // Get current tick count
+unsigned long long timer_get_ticks64() {
+    unsigned long long ticks;
+    unsigned int sequence;
+    do {
+        sequence = read_seqbegin(&ticks_lock);
+        ticks = timer_ticks;
+    } while (read_seqretry(&ticks_lock, sequence));
+    return ticks;
+}
+
+// Low 32 bits of the tick count, which wrap after ~497 days
 unsigned long timer_get_ticks() {
-    return timer_ticks;
+    return (unsigned long)timer_get_ticks64();
 }
 
 // Timer interrupt handler
 void timer_handler() {
-    timer_ticks++;
+    unsigned int ticks = 1;
+    if (oneshot_ticks) {
+        // End of a tickless stretch: every tick in it has now passed
+        ticks = oneshot_ticks;
+        ticks_skipped += ticks - 1;
+        spin_lock(&wheel_lock);
+        oneshot_ticks = 0;
+        spin_unlock(&wheel_lock);
+        pit_set_periodic();
+    }
+    timer_catch_up(ticks);
+    scheduler_tick();
     
     // Display tick every second (100 ticks = 1 second at 100 Hz)
-    if (timer_ticks % 100 == 0) {
+    if ((unsigned long)timer_ticks % 100 == 0) {
         // Update time display (optional - can be removed for less output)
         // print_string(".");
     }
@@ -30,28 +317,46 @@ void timer_handler() {
 
 // Initialize timer
 void timer_init() {
-    // Calculate divisor for desired frequency
+    seqlock_init(&ticks_lock, "timer_ticks");
+    spin_lock_init(&wheel_lock, "timer_wheel");
     // PIT base frequency is 1193182 Hz
-    unsigned int divisor = 1193182 / TIMER_FREQUENCY;
-    
-    // Send command byte: Channel 0, lobyte/hibyte, rate generator
-    outb(PIT_COMMAND, 0x36);
-    
-    // Send divisor
-    outb(PIT_CHANNEL_0, divisor & 0xFF);        // Low byte
-    outb(PIT_CHANNEL_0, (divisor >> 8) & 0xFF); // High byte
+    pit_set_periodic();
     
     print_string("[OK] Timer initialized (");
     print_hex(TIMER_FREQUENCY);
     print_string(" Hz)\n");
 }
 
-// Sleep for specified number of ticks
+static void timer_wake_process(void* data) {
+    scheduler_wake((process_t*)data);
+}
+
+// Sleep for specified number of ticks. A process is blocked until its
+// timer fires; the idle process has nothing to yield to and just halts.
 void timer_wait(unsigned long ticks) {
-    unsigned long target = timer_ticks + ticks;
-    while(timer_ticks < target) {
-        asm volatile("hlt");
+    process_t* current = process_get_current();
+    if (!current || current == process_get_idle()) {
+        unsigned long long target = timer_get_ticks64() + ticks;
+        while(timer_get_ticks64() < target) {
+            asm volatile("hlt");
+        }
+        return;
+    }
+    if (!ticks) return;
+
+    ktimer_t timer;
+    timer.bucket = 0;
+    unsigned int flags = irq_save();
+    timer_add(&timer, ticks, timer_wake_process, current);
+    // The timer may fire on another CPU at any point; block first, then
+    // check, so its wakeup cannot fall between the two
+    for (;;) {
+        scheduler_block(current);
+        if (!timer_pending(&timer) && scheduler_unblock(current)) break;
+        schedule();
+        if (!timer_pending(&timer)) break;
     }
+    irq_restore(flags);
 }
 
 // Sleep for milliseconds
@@ -62,5 +367,5 @@ void sleep_ms(unsigned long ms) {
 
 // Get uptime in seconds
 unsigned long get_uptime() {
-    return timer_ticks / TIMER_FREQUENCY;
+    return timer_get_ticks() / TIMER_FREQUENCY;
 }
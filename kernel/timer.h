@@ -4,6 +4,23 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+// Timer frequency (100 Hz = 100 ticks per second)
+#define TIMER_FREQUENCY 100
+
+// Kernel timer: fn(data) runs from the timer IRQ once the given number
+// of ticks has passed. The caller owns the storage; it must stay valid
+// until the timer fires or is cancelled.
+typedef void (*timer_fn_t)(void* data);
+
+typedef struct ktimer {
+    struct ktimer* next;
+    struct ktimer* prev;
+    struct ktimer** bucket;     // wheel slot it is queued on, 0 if idle
+    unsigned long expires;      // absolute tick
+    timer_fn_t fn;
+    void* data;
+} ktimer_t;
+
 // Initialize PIT timer
 void timer_init();
 
@@ -12,6 +29,7 @@ void timer_handler();
 
 // Get timer ticks
 unsigned long timer_get_ticks();
+unsigned long long timer_get_ticks64();
 
 // Get uptime in seconds
 unsigned long get_uptime();
@@ -19,4 +37,23 @@ unsigned long get_uptime();
 // Sleep for milliseconds
 void sleep_ms(unsigned long ms);
 
+// Sleep for ticks; blocks the calling process
+void timer_wait(unsigned long ticks);
+
+// Arm a timer to fire after ticks (re-arms it if already pending)
+void timer_add(ktimer_t* timer, unsigned long ticks, timer_fn_t fn, void* data);
+
+// Disarm a timer. Returns 1 if it was pending.
+int timer_cancel(ktimer_t* timer);
+
+// Nonzero while a timer is armed
+int timer_pending(ktimer_t* timer);
+
+// Tickless idle: stop the periodic tick around an idle hlt
+int timer_idle_enter();
+void timer_idle_exit();
+void timer_set_tickless(int enabled);
+int timer_get_tickless();
+unsigned long timer_get_ticks_skipped();
+
 #endif
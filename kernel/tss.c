@@ -1,49 +1,49 @@
 // SUB OS - Task State Segment Implementation
 // Copyright (c) 2025 SUB OS Project
+//
+// Each CPU has its own TSS inside its per-CPU area; its descriptor is
+// part of that CPU's GDT (gdt.c), which also loads the task register.
 
 #include "tss.h"
+#include "smp.h"
 #include "kernel.h"
 
-static tss_t tss;
-
-extern void gdt_set_tss(unsigned int base, unsigned int limit);
-extern void tss_flush();
-
-void tss_init() {
-    print_string("[OK] Initializing Task State Segment...\n");
-    
-    unsigned char* ptr = (unsigned char*)&tss;
+// Fill in the calling CPU's TSS
+void tss_init_cpu() {
+    tss_t* tss = &this_cpu()->tss;
+    unsigned char* ptr = (unsigned char*)tss;
     for (unsigned int i = 0; i < sizeof(tss_t); i++) {
         ptr[i] = 0;
     }
     
-    tss.ss0 = 0x10;
-    tss.esp0 = 0;
-    tss.cs = 0x0b;
-    tss.ss = 0x13;
-    tss.ds = 0x13;
-    tss.es = 0x13;
-    tss.fs = 0x13;
-    tss.gs = 0x13;
-    
-    unsigned int base = (unsigned int)&tss;
-    unsigned int limit = sizeof(tss_t) - 1;
-    gdt_set_tss(base, limit);
-    tss_flush();
+    tss->ss0 = GDT_KERNEL_DATA;
+    tss->esp0 = 0;
+    tss->cs = 0x0b;
+    tss->ss = 0x13;
+    tss->ds = 0x13;
+    tss->es = 0x13;
+    tss->fs = 0x13;
+    tss->gs = 0x13;
+    tss->iomap = sizeof(tss_t);     // no I/O permission bitmap
+}
+
+void tss_init() {
+    print_string("[OK] Initializing Task State Segment...\n");
+    tss_init_cpu();
     
     print_string("  TSS base: ");
-    print_hex(base);
+    print_hex((unsigned int)tss_get());
     print_string("\n");
     print_string("  TSS limit: ");
-    print_hex(limit);
+    print_hex(sizeof(tss_t) - 1);
     print_string("\n");
     print_string("[OK] TSS initialized\n");
 }
 
 void tss_set_kernel_stack(unsigned int stack) {
-    tss.esp0 = stack;
+    this_cpu()->tss.esp0 = stack;
 }
 
 tss_t* tss_get() {
-    return &tss;
+    return &this_cpu()->tss;
 }
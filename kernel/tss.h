@@ -36,6 +36,7 @@ typedef struct {
 } __attribute__((packed)) tss_t;
 
 void tss_init();
+void tss_init_cpu();
 void tss_set_kernel_stack(unsigned int stack);
 tss_t* tss_get();
 
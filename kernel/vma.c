@@ -0,0 +1,85 @@
+// SUB OS - Virtual Memory Areas
+// Copyright (c) 2025 SUB OS Project
+
+#include "vma.h"
+#include "slab.h"
+#include "kernel.h"
+
+static kmem_cache_t* vma_cache = 0;
+
+void vma_init() {
+    vma_cache = kmem_cache_create("vm_area", sizeof(vm_area_t), 16, 0);
+}
+
+vm_area_t* vma_add(vm_area_t** list, unsigned int start, unsigned int end, unsigned int flags) {
+    start &= ~0xFFF;
+    end = (end + 0xFFF) & ~0xFFF;
+    if (start >= end) return 0;
+
+    // Keep the list sorted by address and reject overlaps
+    vm_area_t* prev = 0;
+    vm_area_t* next = *list;
+    while (next && next->start < start) {
+        prev = next;
+        next = next->next;
+    }
+    if (prev && prev->end > start) return 0;
+    if (next && next->start < end) return 0;
+
+    vm_area_t* vma = (vm_area_t*)kmem_cache_alloc(vma_cache);
+    if (!vma) return 0;
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->next = next;
+    if (prev) prev->next = vma;
+    else *list = vma;
+    return vma;
+}
+
+vm_area_t* vma_find(vm_area_t* list, unsigned int address) {
+    for (vm_area_t* vma = list; vma; vma = vma->next) {
+        if (address < vma->start) return 0;
+        if (address < vma->end) return vma;
+    }
+    return 0;
+}
+
+// Copy every area of src onto an empty dst list
+int vma_clone(vm_area_t** dst, vm_area_t* src) {
+    vm_area_t** tail = dst;
+    for (vm_area_t* vma = src; vma; vma = vma->next) {
+        vm_area_t* copy = (vm_area_t*)kmem_cache_alloc(vma_cache);
+        if (!copy) {
+            vma_free_all(dst);
+            return 0;
+        }
+        copy->start = vma->start;
+        copy->end = vma->end;
+        copy->flags = vma->flags;
+        copy->next = 0;
+        *tail = copy;
+        tail = &copy->next;
+    }
+    return 1;
+}
+
+void vma_remove(vm_area_t** list, vm_area_t* vma) {
+    for (vm_area_t** link = list; *link; link = &(*link)->next) {
+        if (*link == vma) {
+            *link = vma->next;
+            kmem_cache_free(vma_cache, vma);
+            return;
+        }
+    }
+}
+
+void vma_free_all(vm_area_t** list) {
+    vm_area_t* vma = *list;
+    while (vma) {
+        vm_area_t* next = vma->next;
+        kmem_cache_free(vma_cache, vma);
+        vma = next;
+    }
+    *list = 0;
+}
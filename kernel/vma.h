@@ -0,0 +1,40 @@
+// SUB OS - Virtual Memory Areas Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef VMA_H
+#define VMA_H
+
+// VMA flags
+#define VMA_WRITE   0x1
+#define VMA_USER    0x2
+#define VMA_STACK   0x4
+#define VMA_HEAP    0x8
+#define VMA_IO      0x10    // maps device memory, frames not owned
+
+// A reserved range of a process address space. Pages inside it are only
+// backed by frames once they are touched (see page_fault).
+typedef struct vm_area {
+    unsigned int start;     // page aligned
+    unsigned int end;       // exclusive, page aligned
+    unsigned int flags;
+    struct vm_area* next;
+} vm_area_t;
+
+void vma_init();
+
+// Reserve [start, end) in the given list. Fails (returns 0) on overlap.
+vm_area_t* vma_add(vm_area_t** list, unsigned int start, unsigned int end, unsigned int flags);
+
+// Find the area containing address, or 0
+vm_area_t* vma_find(vm_area_t* list, unsigned int address);
+
+// Copy every area of src onto the empty list dst (fork). Returns 0 on failure.
+int vma_clone(vm_area_t** dst, vm_area_t* src);
+
+// Unlink and release one area of the list
+void vma_remove(vm_area_t** list, vm_area_t* vma);
+
+// Release every area in the list
+void vma_free_all(vm_area_t** list);
+
+#endif
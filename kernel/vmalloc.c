@@ -0,0 +1,147 @@
+// SUB OS - Kernel Virtual Allocator
+// Copyright (c) 2025 SUB OS Project
+//
+// vmalloc hands out page-aligned ranges of [VMALLOC_START, VMALLOC_END)
+// and backs every page with its own frame, so large buffers only need
+// enough free frames, not a contiguous run of them. Ranges are kept as a
+// sorted vm_area list; each is followed by an unmapped guard page so an
+// overrun faults instead of corrupting the next area. ioremap areas share
+// the arena but map given physical pages instead of allocated frames.
+//
+// vmalloc_lock covers the area list and counters. Mapping and unmapping
+// happen outside it: a range is reserved before it is mapped and only
+// released after it has been unmapped.
+
+#include "vmalloc.h"
+#include "vma.h"
+#include "pmm.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "kernel.h"
+
+#define VMALLOC_GUARD  PAGE_SIZE
+
+static vm_area_t* vmalloc_areas = 0;
+static unsigned int vmalloc_area_count = 0;
+static unsigned int vmalloc_pages = 0;
+static spinlock_t vmalloc_lock;
+
+void vmalloc_init() {
+    spin_lock_init(&vmalloc_lock, "vmalloc");
+    vmalloc_areas = 0;
+    vmalloc_area_count = 0;
+    vmalloc_pages = 0;
+    print_string("[OK] vmalloc: ");
+    print_hex(VMALLOC_START);
+    print_string(" - ");
+    print_hex(VMALLOC_END);
+    print_string("\n");
+}
+
+// Drop the mappings of [start, end) with one flush, then free the frames
+static void vmalloc_unmap(unsigned int start, unsigned int end) {
+    unmap_range_free(start, end - start);
+}
+
+// Lowest gap of the arena that fits size bytes plus a guard page.
+// Called with vmalloc_lock held.
+static unsigned int vmalloc_find_gap(unsigned int size) {
+    unsigned int start = VMALLOC_START;
+    for (vm_area_t* vma = vmalloc_areas; vma; vma = vma->next) {
+        if (vma->start - start >= size + VMALLOC_GUARD) return start;
+        start = vma->end;
+    }
+    if (VMALLOC_END - start >= size + VMALLOC_GUARD) return start;
+    return 0;
+}
+
+void* vmalloc(unsigned int size) {
+    if (size == 0 || size > VMALLOC_END - VMALLOC_START - VMALLOC_GUARD) return 0;
+    size = (size + PAGE_SIZE - 1) & PAGE_FRAME;
+
+    // The area covers its guard page so the next gap search skips it
+    unsigned int flags = spin_lock_irqsave(&vmalloc_lock);
+    unsigned int start = vmalloc_find_gap(size);
+    vm_area_t* vma = start ?
+        vma_add(&vmalloc_areas, start, start + size + VMALLOC_GUARD, VMA_WRITE) : 0;
+    spin_unlock_irqrestore(&vmalloc_lock, flags);
+    if (!vma) return 0;
+
+    for (unsigned int off = 0; off < size; off += PAGE_SIZE) {
+        unsigned int frame = pmm_alloc_page_tagged(MEM_TAG_VMALLOC);
+        if (!frame) {
+            vmalloc_unmap(start, start + off);
+            flags = spin_lock_irqsave(&vmalloc_lock);
+            vma_remove(&vmalloc_areas, vma);
+            spin_unlock_irqrestore(&vmalloc_lock, flags);
+            return 0;
+        }
+        map_page(start + off, frame, 1, 1);
+    }
+
+    flags = spin_lock_irqsave(&vmalloc_lock);
+    vmalloc_area_count++;
+    vmalloc_pages += size / PAGE_SIZE;
+    spin_unlock_irqrestore(&vmalloc_lock, flags);
+    return (void*)start;
+}
+
+void vfree(void* ptr) {
+    if (!ptr) return;
+    unsigned int flags = spin_lock_irqsave(&vmalloc_lock);
+    vm_area_t* vma = vma_find(vmalloc_areas, (unsigned int)ptr);
+    if (!vma || vma->start != (unsigned int)ptr || (vma->flags & VMA_IO)) {
+        spin_unlock_irqrestore(&vmalloc_lock, flags);
+        return;
+    }
+    spin_unlock_irqrestore(&vmalloc_lock, flags);
+
+    unsigned int end = vma->end - VMALLOC_GUARD;
+    vmalloc_unmap(vma->start, end);
+
+    flags = spin_lock_irqsave(&vmalloc_lock);
+    vmalloc_area_count--;
+    vmalloc_pages -= (end - vma->start) / PAGE_SIZE;
+    vma_remove(&vmalloc_areas, vma);
+    spin_unlock_irqrestore(&vmalloc_lock, flags);
+}
+
+void* ioremap(phys_addr_t physical_addr, unsigned int size) {
+    unsigned int offset = (unsigned int)physical_addr & ~PAGE_FRAME;
+    phys_addr_t base = physical_addr - offset;
+    if (size == 0 || size > VMALLOC_END - VMALLOC_START - VMALLOC_GUARD - offset) return 0;
+    size = (size + offset + PAGE_SIZE - 1) & PAGE_FRAME;
+
+    unsigned int flags = spin_lock_irqsave(&vmalloc_lock);
+    unsigned int start = vmalloc_find_gap(size);
+    vm_area_t* vma = start ?
+        vma_add(&vmalloc_areas, start, start + size + VMALLOC_GUARD, VMA_WRITE | VMA_IO) : 0;
+    spin_unlock_irqrestore(&vmalloc_lock, flags);
+    if (!vma) return 0;
+    if (!map_range(start, base, size, PAGE_WRITE | PAGE_PCD | PAGE_PWT)) {
+        flags = spin_lock_irqsave(&vmalloc_lock);
+        vma_remove(&vmalloc_areas, vma);
+        spin_unlock_irqrestore(&vmalloc_lock, flags);
+        return 0;
+    }
+    return (void*)(start + offset);
+}
+
+void iounmap(void* ptr) {
+    if (!ptr) return;
+    unsigned int flags = spin_lock_irqsave(&vmalloc_lock);
+    vm_area_t* vma = vma_find(vmalloc_areas, (unsigned int)ptr);
+    spin_unlock_irqrestore(&vmalloc_lock, flags);
+    if (!vma || !(vma->flags & VMA_IO)) return;
+    unmap_range(vma->start, vma->end - VMALLOC_GUARD - vma->start);
+    flags = spin_lock_irqsave(&vmalloc_lock);
+    vma_remove(&vmalloc_areas, vma);
+    spin_unlock_irqrestore(&vmalloc_lock, flags);
+}
+
+void vmalloc_get_stats(unsigned int* areas, unsigned int* pages) {
+    unsigned int flags = spin_lock_irqsave(&vmalloc_lock);
+    if (areas) *areas = vmalloc_area_count;
+    if (pages) *pages = vmalloc_pages;
+    spin_unlock_irqrestore(&vmalloc_lock, flags);
+}
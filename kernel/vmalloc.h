@@ -0,0 +1,29 @@
+// SUB OS - Kernel Virtual Allocator Header
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include "pmm.h"
+
+// Reserved kernel virtual range for vmalloc areas
+#define VMALLOC_START   0xD0000000
+#define VMALLOC_END     0xE0000000
+
+void vmalloc_init();
+
+// Page-granular, virtually contiguous allocations backed by individual
+// frames. Use pmm_alloc_pages only when the hardware needs physically
+// contiguous memory (DMA).
+void* vmalloc(unsigned int size);
+void vfree(void* ptr);
+
+// Map physical_addr (device registers, firmware tables) outside the
+// direct map, uncached. The pointer keeps the offset within the page.
+void* ioremap(phys_addr_t physical_addr, unsigned int size);
+void iounmap(void* ptr);
+
+// Statistics
+void vmalloc_get_stats(unsigned int* areas, unsigned int* pages);
+
+#endif
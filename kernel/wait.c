@@ -0,0 +1,183 @@
+// SUB OS - Wait Queues, Mutexes and Semaphores
+// Copyright (c) 2025 SUB OS Project
+//
+// A wait queue is a locked list of sleepers, each an entry on its own
+// stack. Sleeping is scheduler_block plus schedule(); waking takes the
+// entry off the queue and hands it to scheduler_wake, which only acts on
+// a process that is still blocked. Everything else (the condition, who
+// gets woken) is up to the caller, as with Linux's wait_event.
+//
+// Mutexes and semaphores only touch their wait queue when contended; the
+// uncontended paths are a single atomic instruction.
+
+#include "wait.h"
+#include "process.h"
+
+void wait_queue_init(wait_queue_t* queue) {
+    // Unnamed: queues come and go with the objects they belong to, so
+    // they stay out of the lock statistics
+    spin_lock_init(&queue->lock, 0);
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+static void wait_queue_append(wait_queue_t* queue, wait_entry_t* entry) {
+    entry->next = 0;
+    entry->prev = queue->tail;
+    if (queue->tail) queue->tail->next = entry;
+    else queue->head = entry;
+    queue->tail = entry;
+    entry->queued = 1;
+}
+
+static void wait_queue_unlink(wait_queue_t* queue, wait_entry_t* entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else queue->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else queue->tail = entry->prev;
+    entry->next = entry->prev = 0;
+    entry->queued = 0;
+}
+
+void wait_entry_init(wait_entry_t* entry) {
+    entry->process = 0;
+    entry->key = 0;
+    entry->queued = 0;
+    entry->next = 0;
+    entry->prev = 0;
+}
+
+// Queue the caller and mark it blocked. The idle process never blocks:
+// it has no one to hand the CPU to, so it is not queued at all.
+void wait_prepare(wait_queue_t* queue, wait_entry_t* entry) {
+    process_t* current = process_get_current();
+    if (!current || current == process_get_idle()) {
+        entry->process = 0;
+        return;
+    }
+    entry->process = current;
+    unsigned int flags = spin_lock_irqsave(&queue->lock);
+    if (!entry->queued) wait_queue_append(queue, entry);
+    scheduler_block(current);
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+// Sleep until woken. Callers that cannot block halt until the next
+// interrupt, or spin if interrupts are off (early boot).
+void wait_schedule(wait_entry_t* entry) {
+    if (entry->process) {
+        schedule();
+    } else if (irq_enabled()) {
+        process_idle();
+    } else {
+        cpu_relax();
+    }
+}
+
+void wait_finish(wait_queue_t* queue, wait_entry_t* entry) {
+    process_t* process = entry->process;
+    if (!process) return;
+    unsigned int flags = spin_lock_irqsave(&queue->lock);
+    if (entry->queued) wait_queue_unlink(queue, entry);
+    spin_unlock_irqrestore(&queue->lock, flags);
+
+    // The condition may have come true without a sleep, leaving us marked
+    // blocked. If a wakeup raced in first we are already queued to run,
+    // and have to go through the scheduler to take that slot.
+    if (!scheduler_unblock(process) && process->state == PROCESS_READY) schedule();
+}
+
+static void wait_timeout(void* data) {
+    scheduler_wake((process_t*)data);
+}
+
+// Arm a timer that wakes the caller after ticks
+void wait_timer_start(ktimer_t* timer, unsigned long ticks) {
+    timer->bucket = 0;
+    timer_add(timer, ticks, wait_timeout, process_get_current());
+}
+
+// Wake up to count sleepers (all if count < 0) whose key matches, or
+// any sleeper if match_any is set
+static int wake_up_common(wait_queue_t* queue, unsigned long long key, int match_any,
+                          int count) {
+    int woken = 0;
+    unsigned int flags = spin_lock_irqsave(&queue->lock);
+    wait_entry_t* entry = queue->head;
+    while (entry && (count < 0 || woken < count)) {
+        wait_entry_t* next = entry->next;
+        if (match_any || entry->key == key) {
+            wait_queue_unlink(queue, entry);
+            scheduler_wake(entry->process);
+            woken++;
+        }
+        entry = next;
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+    return woken;
+}
+
+int wake_up(wait_queue_t* queue) {
+    return wake_up_common(queue, 0, 1, 1);
+}
+
+int wake_up_all(wait_queue_t* queue) {
+    return wake_up_common(queue, 0, 1, -1);
+}
+
+int wake_up_key(wait_queue_t* queue, unsigned long long key, int count) {
+    return wake_up_common(queue, key, 0, count);
+}
+
+void mutex_init(mutex_t* mutex) {
+    atomic_set(&mutex->state, 0);
+    mutex->owner = 0;
+    wait_queue_init(&mutex->waiters);
+}
+
+void mutex_lock(mutex_t* mutex) {
+    if (atomic_cmpxchg(&mutex->state, 0, 1) != 0) {
+        // Contended: mark it so the holder wakes someone on unlock, and
+        // keep it marked, since other sleepers may remain
+        wait_event(&mutex->waiters, atomic_xchg(&mutex->state, 2) == 0);
+    }
+    mutex->owner = process_get_current();
+}
+
+// Take the mutex if it is free. Returns nonzero on success.
+int mutex_trylock(mutex_t* mutex) {
+    if (atomic_cmpxchg(&mutex->state, 0, 1) != 0) return 0;
+    mutex->owner = process_get_current();
+    return 1;
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    mutex->owner = 0;
+    if (atomic_xchg(&mutex->state, 0) == 2) wake_up(&mutex->waiters);
+}
+
+void sem_init(semaphore_t* sem, int count) {
+    atomic_set(&sem->count, count);
+    wait_queue_init(&sem->waiters);
+}
+
+// Take one unit if available. Returns nonzero on success.
+int sem_trydown(semaphore_t* sem) {
+    int count = atomic_read(&sem->count);
+    while (count > 0) {
+        int seen = atomic_cmpxchg(&sem->count, count, count - 1);
+        if (seen == count) return 1;
+        count = seen;
+    }
+    return 0;
+}
+
+void sem_down(semaphore_t* sem) {
+    if (sem_trydown(sem)) return;
+    wait_event(&sem->waiters, sem_trydown(sem));
+}
+
+void sem_up(semaphore_t* sem) {
+    atomic_add_return(&sem->count, 1);     // ordered before the wakeup
+    wake_up(&sem->waiters);
+}
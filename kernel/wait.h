@@ -0,0 +1,103 @@
+// SUB OS - Wait Queues, Mutexes and Semaphores
+// Copyright (c) 2025 SUB OS Project
+
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "spinlock.h"
+#include "timer.h"
+
+struct process;
+
+// A sleeper's place on a wait queue. It lives on the sleeper's stack for
+// the duration of one wait_event.
+typedef struct wait_entry {
+    struct process* process;        // 0 if the caller cannot block
+    unsigned long long key;         // futex key (physical address), 0 for plain waits
+    int queued;
+    struct wait_entry* next;
+    struct wait_entry* prev;
+} wait_entry_t;
+
+typedef struct {
+    spinlock_t lock;
+    wait_entry_t* head;
+    wait_entry_t* tail;
+} wait_queue_t;
+
+// Sleeping lock. state is 0 when free, 1 when held, 2 when held with
+// sleepers, so an uncontended lock/unlock is one atomic each.
+typedef struct {
+    atomic_t state;
+    struct process* owner;
+    wait_queue_t waiters;
+} mutex_t;
+
+typedef struct {
+    atomic_t count;
+    wait_queue_t waiters;
+} semaphore_t;
+
+void wait_queue_init(wait_queue_t* queue);
+
+// Building blocks of wait_event. wait_prepare queues the caller and marks
+// it blocked before the condition is tested, so a wakeup between the test
+// and the sleep is not lost.
+void wait_entry_init(wait_entry_t* entry);
+void wait_prepare(wait_queue_t* queue, wait_entry_t* entry);
+void wait_schedule(wait_entry_t* entry);
+void wait_finish(wait_queue_t* queue, wait_entry_t* entry);
+void wait_timer_start(ktimer_t* timer, unsigned long ticks);
+
+// Wake one sleeper, all of them, or up to count with the given key.
+// Return the number woken.
+int wake_up(wait_queue_t* queue);
+int wake_up_all(wait_queue_t* queue);
+int wake_up_key(wait_queue_t* queue, unsigned long long key, int count);
+
+// Sleep until condition is true. The condition is re-tested after every
+// wakeup, so wakers just change state and call wake_up. The idle process
+// (and code running with interrupts off) cannot sleep; it halts or spins
+// between tests instead.
+#define wait_event(queue, condition)                \
+    do {                                            \
+        wait_entry_t __wait;                        \
+        wait_entry_init(&__wait);                   \
+        for (;;) {                                  \
+            wait_prepare((queue), &__wait);         \
+            if (condition) break;                   \
+            wait_schedule(&__wait);                 \
+        }                                           \
+        wait_finish((queue), &__wait);              \
+    } while (0)
+
+// As wait_event, but give up after ticks. Evaluates to nonzero if the
+// condition became true, 0 on timeout.
+#define wait_event_timeout(queue, condition, ticks)                 \
+    ({                                                              \
+        wait_entry_t __wait;                                        \
+        ktimer_t __timer;                                           \
+        int __done;                                                 \
+        wait_entry_init(&__wait);                                   \
+        wait_timer_start(&__timer, (ticks));                        \
+        for (;;) {                                                  \
+            wait_prepare((queue), &__wait);                         \
+            if ((__done = !!(condition)) || !timer_pending(&__timer)) break; \
+            wait_schedule(&__wait);                                 \
+        }                                                           \
+        wait_finish((queue), &__wait);                              \
+        timer_cancel(&__timer);                                     \
+        __done;                                                     \
+    })
+
+void mutex_init(mutex_t* mutex);
+void mutex_lock(mutex_t* mutex);
+int mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+void sem_init(semaphore_t* sem, int count);
+void sem_down(semaphore_t* sem);
+int sem_trydown(semaphore_t* sem);
+void sem_up(semaphore_t* sem);
+
+#endif